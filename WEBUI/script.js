@@ -17,20 +17,80 @@ document.addEventListener('DOMContentLoaded', function () {
         scanBtn.innerHTML = '<span class="loading"></span>Scanning...';
         updateStatus('Scanning for WiFi networks...');
 
-        fetch('/api/wifi/scan')
-            .then(response => response.json())
-            .then(data => {
-                displayNetworks(data.networks);
-                updateStatus(`Found ${data.networks.length} WiFi networks.`);
-            })
-            .catch(error => {
-                console.error('Scan error:', error);
-                updateStatus('Error scanning networks. Please try again.');
-            })
-            .finally(() => {
-                scanBtn.disabled = false;
-                scanBtn.innerHTML = 'Scan Networks';
+        // The device scans in the background: show the cached results right
+        // away and poll until the fresh scan is done
+        const scanDone = () => {
+            scanBtn.disabled = false;
+            scanBtn.innerHTML = 'Scan Networks';
+        };
+        const pollScan = (url, attempts) => {
+            fetch(url)
+                .then(response => response.json())
+                .then(data => {
+                    if (data.networks.length > 0 || !data.scanning) {
+                        displayNetworks(data.networks);
+                    }
+                    if (data.scanning && attempts > 0) {
+                        setTimeout(() => pollScan('/api/wifi/scan', attempts - 1), 1000);
+                        return;
+                    }
+                    updateStatus(`Found ${data.networks.length} WiFi networks.`);
+                    scanDone();
+                })
+                .catch(error => {
+                    console.error('Scan error:', error);
+                    updateStatus('Error scanning networks. Please try again.');
+                    scanDone();
+                });
+        };
+
+        if (!window.EventSource) {
+            pollScan('/api/wifi/scan?refresh=1', 15);
+            return;
+        }
+
+        // Channel-by-channel scan: render each channel's networks as soon
+        // as the device pushes them
+        const found = [];
+        let received = false;
+        const source = new EventSource('/api/wifi/scan/stream');
+        source.addEventListener('networks', event => {
+            received = true;
+            // A network seen again on a later channel replaces its record
+            JSON.parse(event.data).networks.forEach(network => {
+                const i = found.findIndex(n => n.ssid === network.ssid);
+                if (i >= 0) {
+                    found[i] = network;
+                } else {
+                    found.push(network);
+                }
             });
+            found.sort((a, b) => b.rssi - a.rssi);
+            displayNetworks(found);
+        });
+        source.addEventListener('reset', () => {
+            found.length = 0;
+        });
+        source.addEventListener('progress', event => {
+            const progress = JSON.parse(event.data);
+            updateStatus(`Scanning channel ${progress.channel} of ${progress.last}, ${found.length} networks so far...`);
+        });
+        source.addEventListener('done', () => {
+            source.close();
+            displayNetworks(found);
+            updateStatus(`Found ${found.length} WiFi networks.`);
+            scanDone();
+        });
+        source.onerror = () => {
+            // Without the stream (server busy, older firmware) fall back to polling
+            source.close();
+            if (!received) {
+                pollScan('/api/wifi/scan?refresh=1', 15);
+            } else {
+                updateStatus(`Scan interrupted, ${found.length} networks found.`);
+                scanDone();
+            }
+        };
     });
 
     // LED control buttons
@@ -85,14 +145,16 @@ document.addEventListener('DOMContentLoaded', function () {
             const networkDiv = document.createElement('div');
             networkDiv.className = 'network-item';
 
-            const signalStrength = getSignalStrength(network.rssi);
+            const signalStrength = getSignalStrength(network.rssi_avg ?? network.rssi);
             const authIcon = getAuthIcon(network.authmode);
+            const channels = network.channels ? network.channels.join(', ') : network.channel;
+            const aps = network.aps > 1 ? ` | ${network.aps} APs` : '';
 
             networkDiv.innerHTML = `
                 <div class="network-info">
                     <div class="network-ssid">${network.ssid}</div>
                     <div class="network-details">
-                        Signal: ${signalStrength} | Channel: ${network.channel} | Security: ${network.authmode.toUpperCase()} ${authIcon}
+                        Signal: ${signalStrength}${getTrendIcon(network.trend)} | Channel: ${channels}${aps} | Security: ${network.authmode.toUpperCase()} ${authIcon}
                     </div>
                 </div>
                 <div class="network-connect">
@@ -156,6 +218,13 @@ document.addEventListener('DOMContentLoaded', function () {
         return 'Weak';
     }
 
+    // trend is the RSSI change in dB over the device's recent scans
+    function getTrendIcon(trend) {
+        if (trend >= 3) return ' ↑';
+        if (trend <= -3) return ' ↓';
+        return '';
+    }
+
     function getAuthIcon(authmode) {
         switch (authmode) {
             case 'open': return '🔓';
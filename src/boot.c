@@ -0,0 +1,44 @@
+/* Boot phase timestamps, see boot.h */
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "boot.h"
+
+static const char *TAG_HTTP = "HTTP Server";
+
+static const char *const boot_phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_APP_MAIN] = "app_main",
+    [BOOT_NVS_READY] = "nvs_ready",
+    [BOOT_WIFI_STARTED] = "wifi_started",
+    [BOOT_AP_STARTED] = "ap_started",
+    [BOOT_STORAGE_READY] = "storage_ready",
+    [BOOT_HTTP_STARTED] = "http_started",
+    [BOOT_HTTP_FIRST_RESPONSE] = "http_first_response",
+    [BOOT_STA_CONNECTED] = "sta_connected",
+    [BOOT_STA_GOT_IP] = "sta_got_ip",
+};
+
+/* Marked from app_main, the event loop and any HTTP worker, so the first
+ * writer of a slot wins through a compare-and-swap */
+static _Atomic int64_t boot_phase_us[BOOT_PHASE_COUNT];
+
+void boot_mark(enum boot_phase phase)
+{
+    int64_t unset = 0;
+    const int64_t now = esp_timer_get_time();
+
+    if (atomic_load(&boot_phase_us[phase]) == 0 && atomic_compare_exchange_strong(&boot_phase_us[phase], &unset, now))
+    {
+        ESP_LOGI(TAG_HTTP, "Boot phase %s at %lld ms", boot_phase_names[phase], (long long)(now / 1000));
+    }
+}
+
+int64_t boot_phase_time(enum boot_phase phase)
+{
+    return atomic_load(&boot_phase_us[phase]);
+}
+
+const char *boot_phase_name(enum boot_phase phase)
+{
+    return boot_phase_names[phase];
+}
@@ -0,0 +1,28 @@
+/* Boot phases, with the esp_timer time each was first reached (0 until
+ * then), served by /api/boot to track e.g. time to first HTTP response */
+#pragma once
+
+#include <stdint.h>
+
+enum boot_phase
+{
+    BOOT_APP_MAIN,
+    BOOT_NVS_READY,
+    BOOT_WIFI_STARTED,
+    BOOT_AP_STARTED,
+    BOOT_STORAGE_READY,
+    BOOT_HTTP_STARTED,
+    BOOT_HTTP_FIRST_RESPONSE,
+    BOOT_STA_CONNECTED,
+    BOOT_STA_GOT_IP,
+    BOOT_PHASE_COUNT,
+};
+
+/* Records the time phase is reached, unless it was already. Safe from any
+ * task */
+void boot_mark(enum boot_phase phase);
+
+/* esp_timer time phase was first reached, 0 if it has not been yet */
+int64_t boot_phase_time(enum boot_phase phase);
+
+const char *boot_phase_name(enum boot_phase phase);
@@ -0,0 +1,19 @@
+/* Candidate ranking for the saved network selection, see cred_rank.h */
+#include "cred_rank.h"
+
+/* Insertion sort: at most CRED_MAX candidates, and stable */
+void cred_rank(struct sta_candidate *list, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        const struct sta_candidate c = list[i];
+        int k = i;
+        for (; k > 0 && (list[k - 1].priority < c.priority ||
+                         (list[k - 1].priority == c.priority && list[k - 1].rssi < c.rssi));
+             k--)
+        {
+            list[k] = list[k - 1];
+        }
+        list[k] = c;
+    }
+}
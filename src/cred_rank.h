@@ -0,0 +1,19 @@
+/* Ranking of the saved networks a selection scan found. Plain C without
+ * ESP-IDF dependencies */
+#pragma once
+
+#include <stdint.h>
+
+struct sta_candidate
+{
+    char ssid[33];
+    uint8_t bssid[6];     /* Strongest BSSID the scan found */
+    uint8_t channel;
+    int8_t rssi;
+    uint8_t priority;
+};
+
+/* Sorts list by priority, highest first, and by RSSI among equal
+ * priorities, strongest first. Candidates that tie on both keep their
+ * order */
+void cred_rank(struct sta_candidate *list, int count);
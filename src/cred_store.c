@@ -0,0 +1,154 @@
+/* Saved networks, see cred_store.h */
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "cred_store.h"
+
+static const char *TAG_STA = "WiFi Sta";
+
+#define CRED_NVS_NAMESPACE "wifi_creds"
+#define CRED_NVS_KEY "list"
+#define CRED_VERSION 1
+
+static struct
+{
+    uint8_t version;
+    uint8_t count;
+    struct wifi_cred creds[CRED_MAX];
+} cred_store;
+
+static SemaphoreHandle_t cred_lock = NULL;
+
+esp_err_t init_cred_store(void)
+{
+    cred_lock = xSemaphoreCreateMutex();
+    return cred_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void cred_store_load(void)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof(cred_store);
+
+    memset(&cred_store, 0, sizeof(cred_store));
+    if (nvs_open(CRED_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_get_blob(nvs, CRED_NVS_KEY, &cred_store, &size) != ESP_OK ||
+        size != sizeof(cred_store) || cred_store.version != CRED_VERSION || cred_store.count > CRED_MAX)
+    {
+        memset(&cred_store, 0, sizeof(cred_store));
+    }
+    nvs_close(nvs);
+    ESP_LOGI(TAG_STA, "%d saved networks", cred_store.count);
+}
+
+/* Called with cred_lock held */
+static esp_err_t cred_store_save_locked(void)
+{
+    nvs_handle_t nvs;
+
+    cred_store.version = CRED_VERSION;
+    esp_err_t err = nvs_open(CRED_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    err = nvs_set_blob(nvs, CRED_NVS_KEY, &cred_store, sizeof(cred_store));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+/* Called with cred_lock held */
+static struct wifi_cred *cred_store_find_locked(const char *ssid)
+{
+    for (int i = 0; i < cred_store.count; i++)
+    {
+        if (strcmp(cred_store.creds[i].ssid, ssid) == 0)
+        {
+            return &cred_store.creds[i];
+        }
+    }
+    return NULL;
+}
+
+int cred_store_count(void)
+{
+    xSemaphoreTake(cred_lock, portMAX_DELAY);
+    const int count = cred_store.count;
+    xSemaphoreGive(cred_lock);
+    return count;
+}
+
+esp_err_t cred_store_add(const char *ssid, const char *password, uint8_t priority)
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(cred_lock, portMAX_DELAY);
+    struct wifi_cred *cred = cred_store_find_locked(ssid);
+    if (!cred && cred_store.count < CRED_MAX)
+    {
+        cred = &cred_store.creds[cred_store.count++];
+    }
+    if (cred)
+    {
+        strlcpy(cred->ssid, ssid, sizeof(cred->ssid));
+        strlcpy(cred->password, password, sizeof(cred->password));
+        cred->priority = priority;
+        err = cred_store_save_locked();
+    }
+    else
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(cred_lock);
+    return err;
+}
+
+esp_err_t cred_store_remove(const char *ssid)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(cred_lock, portMAX_DELAY);
+    struct wifi_cred *cred = cred_store_find_locked(ssid);
+    if (cred)
+    {
+        *cred = cred_store.creds[--cred_store.count];
+        memset(&cred_store.creds[cred_store.count], 0, sizeof(cred_store.creds[0]));
+        err = cred_store_save_locked();
+    }
+    xSemaphoreGive(cred_lock);
+    return err;
+}
+
+bool cred_store_config(wifi_config_t *config, const char *ssid)
+{
+    xSemaphoreTake(cred_lock, portMAX_DELAY);
+    const struct wifi_cred *cred = cred_store_find_locked(ssid);
+    if (cred)
+    {
+        memset(config->sta.ssid, 0, sizeof(config->sta.ssid));
+        memset(config->sta.password, 0, sizeof(config->sta.password));
+        strncpy((char *)config->sta.ssid, cred->ssid, sizeof(config->sta.ssid));
+        strncpy((char *)config->sta.password, cred->password, sizeof(config->sta.password));
+        config->sta.threshold.authmode = cred->password[0] ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+    }
+    xSemaphoreGive(cred_lock);
+    return cred != NULL;
+}
+
+int cred_store_copy(struct wifi_cred *creds)
+{
+    xSemaphoreTake(cred_lock, portMAX_DELAY);
+    const int count = cred_store.count;
+    memcpy(creds, cred_store.creds, count * sizeof(creds[0]));
+    xSemaphoreGive(cred_lock);
+    return count;
+}
@@ -0,0 +1,45 @@
+/* Saved networks: up to CRED_MAX SSIDs with their password and a
+ * priority, kept in NVS as one blob. When any are saved, the station
+ * connects by scanning once and trying the saved networks that scan found,
+ * ranked by cred_rank(). When a candidate fails, the next one is tried
+ * without scanning again */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_wifi.h"
+
+#define CRED_MAX 8
+#define CRED_DEFAULT_PRIORITY 100
+#define CRED_SSID_SIZE 33
+#define CRED_PASSWORD_SIZE 65
+
+struct wifi_cred
+{
+    char ssid[CRED_SSID_SIZE];
+    char password[CRED_PASSWORD_SIZE];
+    uint8_t priority;     /* Higher is preferred */
+};
+
+esp_err_t init_cred_store(void);
+
+/* Reads the saved networks from NVS */
+void cred_store_load(void);
+
+int cred_store_count(void);
+
+/* Saves a network, replacing the password and priority of one already
+ * saved under the same SSID. ESP_ERR_NO_MEM when the store is full */
+esp_err_t cred_store_add(const char *ssid, const char *password, uint8_t priority);
+
+/* ESP_ERR_NOT_FOUND if ssid is not saved */
+esp_err_t cred_store_remove(const char *ssid);
+
+/* Fills in the STA credentials of a saved network. Returns false if ssid
+ * is not saved */
+bool cred_store_config(wifi_config_t *config, const char *ssid);
+
+/* Copies the saved networks into creds, which has room for CRED_MAX.
+ * Returns how many. The caller clears the passwords once done */
+int cred_store_copy(struct wifi_cred *creds);
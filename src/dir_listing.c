@@ -0,0 +1,284 @@
+/* Directory listings, see dir_listing.h */
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "dir_listing.h"
+#include "http_workers.h"
+#include "json_writer.h"
+#include "storage.h"
+
+static const char *TAG_HTTP = "HTTP Server";
+
+/* Max length of a name in a directory listing, longer names are skipped */
+#define DIR_ENTRY_NAME_MAX 64
+
+/* Page size of JSON listings when the request does not give a limit */
+#define DIR_LIST_DEFAULT_LIMIT 100
+
+struct dir_snapshot_entry
+{
+    char name[DIR_ENTRY_NAME_MAX];
+    bool is_dir;
+    size_t size;
+};
+
+/* Contents of one directory, with the stat() of every entry already done.
+ * The last listed directory is kept until the filesystem changes; a
+ * snapshot stays valid for as long as a request holds a reference */
+struct dir_snapshot
+{
+    int refs;
+    char dirpath[FILE_PATH_MAX];
+    unsigned int generation; /* storage_generation when taken */
+    size_t used;             /* Used bytes on storage when taken, catches writes made through the VFS directly */
+    size_t count;
+    struct dir_snapshot_entry entries[];
+};
+
+static struct dir_snapshot *dir_snapshot_cached = NULL;
+static SemaphoreHandle_t dir_snapshot_lock = NULL;
+
+esp_err_t init_dir_listing(void)
+{
+    dir_snapshot_lock = xSemaphoreCreateMutex();
+    return dir_snapshot_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void dir_snapshot_release(struct dir_snapshot *snap)
+{
+    xSemaphoreTake(dir_snapshot_lock, portMAX_DELAY);
+    bool last = --snap->refs == 0;
+    xSemaphoreGive(dir_snapshot_lock);
+    if (last)
+    {
+        free(snap);
+    }
+}
+
+static struct dir_snapshot *dir_snapshot_take(const char *dirpath, unsigned int generation, size_t used)
+{
+    DIR *dir = opendir(dirpath);
+    if (!dir)
+    {
+        return NULL;
+    }
+
+    size_t capacity = 16;
+    struct dir_snapshot *snap = malloc(sizeof(*snap) + capacity * sizeof(snap->entries[0]));
+    if (!snap)
+    {
+        closedir(dir);
+        return NULL;
+    }
+    snap->refs = 1;
+    strlcpy(snap->dirpath, dirpath, sizeof(snap->dirpath));
+    snap->generation = generation;
+    snap->used = used;
+    snap->count = 0;
+
+    char entrypath[FILE_PATH_MAX];
+    const size_t dirpath_len = strlcpy(entrypath, dirpath, sizeof(entrypath));
+    struct dirent *entry;
+    struct stat entry_stat;
+
+    /* Iterate over all files / folders and fetch their names and sizes */
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strlen(entry->d_name) >= DIR_ENTRY_NAME_MAX)
+        {
+            ESP_LOGW(TAG_HTTP, "Name too long for listing : %s", entry->d_name);
+            continue;
+        }
+        strlcpy(entrypath + dirpath_len, entry->d_name, sizeof(entrypath) - dirpath_len);
+        if (stat(entrypath, &entry_stat) == -1)
+        {
+            ESP_LOGE(TAG_HTTP, "Failed to stat %s", entry->d_name);
+            continue;
+        }
+
+        if (snap->count == capacity)
+        {
+            capacity *= 2;
+            struct dir_snapshot *grown = realloc(snap, sizeof(*snap) + capacity * sizeof(snap->entries[0]));
+            if (!grown)
+            {
+                free(snap);
+                closedir(dir);
+                return NULL;
+            }
+            snap = grown;
+        }
+
+        struct dir_snapshot_entry *e = &snap->entries[snap->count++];
+        strlcpy(e->name, entry->d_name, sizeof(e->name));
+        e->is_dir = entry->d_type == DT_DIR;
+        e->size = entry_stat.st_size;
+        ESP_LOGD(TAG_HTTP, "Found %s : %s (%u bytes)", e->is_dir ? "directory" : "file", e->name,
+                 (unsigned)e->size);
+    }
+    closedir(dir);
+    return snap;
+}
+
+/* Returns a referenced snapshot of dirpath, from the cache when the
+ * filesystem has not changed since it was taken */
+static struct dir_snapshot *dir_snapshot_get(const char *dirpath)
+{
+    size_t total = 0, used = 0;
+    storage_info(&total, &used);
+    const unsigned int generation = storage_generation();
+
+    xSemaphoreTake(dir_snapshot_lock, portMAX_DELAY);
+    struct dir_snapshot *snap = dir_snapshot_cached;
+    if (snap && snap->generation == generation && snap->used == used && strcmp(snap->dirpath, dirpath) == 0)
+    {
+        snap->refs++;
+        xSemaphoreGive(dir_snapshot_lock);
+        return snap;
+    }
+    xSemaphoreGive(dir_snapshot_lock);
+
+    snap = dir_snapshot_take(dirpath, generation, used);
+    if (!snap)
+    {
+        return NULL;
+    }
+
+    xSemaphoreTake(dir_snapshot_lock, portMAX_DELAY);
+    struct dir_snapshot *old = dir_snapshot_cached;
+    dir_snapshot_cached = snap;
+    snap->refs++; /* One for the cache, one for the caller */
+    xSemaphoreGive(dir_snapshot_lock);
+    if (old)
+    {
+        dir_snapshot_release(old);
+    }
+    return snap;
+}
+
+static void http_resp_dir_rows_html(struct chunk_writer *w, const struct dir_snapshot *snap, const char *uripath)
+{
+    /* Send HTML file header */
+    chunk_writer_puts(w, "<!DOCTYPE html><html><body>");
+
+    /* Send file-list table definition and column labels */
+    chunk_writer_puts(w,
+                      "<table class=\"fixed\" border=\"1\">"
+                      "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
+                      "<thead><tr><th>Name</th><th>Type</th><th>Size (Bytes)</th><th>Delete</th></tr></thead>"
+                      "<tbody>");
+
+    for (size_t i = 0; i < snap->count; i++)
+    {
+        const struct dir_snapshot_entry *e = &snap->entries[i];
+
+        /* Table entries with file name, type, size and delete button */
+        chunk_writer_puts(w, "<tr><td><a href=\"");
+        chunk_writer_put_html(w, uripath);
+        chunk_writer_put_html(w, e->name);
+        if (e->is_dir)
+        {
+            chunk_writer_puts(w, "/");
+        }
+        chunk_writer_puts(w, "\">");
+        chunk_writer_put_html(w, e->name);
+        chunk_writer_puts(w, "</a></td><td>");
+        chunk_writer_puts(w, e->is_dir ? "directory" : "file");
+        chunk_writer_printf(w, "</td><td>%u</td><td>", (unsigned)e->size);
+        chunk_writer_puts(w, "<form method=\"post\" action=\"/delete");
+        chunk_writer_put_html(w, uripath);
+        chunk_writer_put_html(w, e->name);
+        chunk_writer_puts(w, "\"><button type=\"submit\">Delete</button></form>");
+        chunk_writer_puts(w, "</td></tr>\n");
+    }
+
+    /* Finish the file list table and the HTML file */
+    chunk_writer_puts(w, "</tbody></table></body></html>");
+}
+
+static void http_resp_dir_rows_json(struct chunk_writer *w, const struct dir_snapshot *snap, const char *uripath,
+                                    size_t offset, size_t limit)
+{
+    struct json_writer j = {.out = w};
+
+    json_object_begin(&j, NULL);
+    json_str(&j, "path", uripath);
+    json_int(&j, "total", snap->count);
+    json_int(&j, "offset", offset);
+    json_int(&j, "limit", limit);
+    json_array_begin(&j, "entries");
+    for (size_t i = offset; i < snap->count && i - offset < limit; i++)
+    {
+        const struct dir_snapshot_entry *e = &snap->entries[i];
+
+        json_object_begin(&j, NULL);
+        json_str(&j, "name", e->name);
+        json_str(&j, "type", e->is_dir ? "directory" : "file");
+        json_int(&j, "size", e->size);
+        json_object_end(&j);
+    }
+    json_array_end(&j);
+    json_object_end(&j);
+}
+
+esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath, const char *uripath)
+{
+    char query[64] = "";
+    char param[16];
+    bool json = false;
+    size_t offset = 0;
+    size_t limit = DIR_LIST_DEFAULT_LIMIT;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        json = httpd_query_key_value(query, "format", param, sizeof(param)) == ESP_OK && strcmp(param, "json") == 0;
+        if (httpd_query_key_value(query, "offset", param, sizeof(param)) == ESP_OK)
+        {
+            offset = strtoul(param, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "limit", param, sizeof(param)) == ESP_OK)
+        {
+            limit = strtoul(param, NULL, 10);
+        }
+    }
+
+    struct dir_snapshot *snap = dir_snapshot_get(dirpath);
+    if (!snap)
+    {
+        ESP_LOGE(TAG_HTTP, "Failed to stat dir : %s", dirpath);
+        /* Respond with 404 Not Found */
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Directory does not exist");
+        return ESP_FAIL;
+    }
+
+    char *buf = transfer_buf_acquire();
+    if (!buf)
+    {
+        dir_snapshot_release(snap);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_sendstr(req, "Server busy");
+        return ESP_FAIL;
+    }
+
+    struct chunk_writer w = {.req = req, .buf = buf, .size = TRANSFER_BUF_SIZE};
+    if (json)
+    {
+        httpd_resp_set_type(req, "application/json");
+        http_resp_dir_rows_json(&w, snap, uripath, offset, limit);
+    }
+    else
+    {
+        http_resp_dir_rows_html(&w, snap, uripath);
+    }
+
+    /* Send the rest and the empty chunk that signals HTTP response completion */
+    esp_err_t ret = chunk_writer_finish(&w);
+    transfer_buf_release(buf);
+    dir_snapshot_release(snap);
+    return ret;
+}
@@ -0,0 +1,14 @@
+/* Directory listings of the storage filesystem */
+#pragma once
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+esp_err_t init_dir_listing(void);
+
+/* Send HTTP response with a list of all files and folders under the
+ * requested path, as html or, with "?format=json", as JSON paginated by
+ * the "offset" and "limit" query parameters.
+ * On SPIFFS this returns an empty list for any path other than '/',
+ * since SPIFFS doesn't support directories; LittleFS lists subdirectories */
+esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath, const char *uripath);
@@ -0,0 +1,454 @@
+/* Static file metadata LRU and response cache, see file_cache.h */
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "file_cache.h"
+#include "http_util.h"
+#include "storage.h"
+#include "webui_bundle.h"
+
+const struct content_encoding content_encodings[CONTENT_ENCODING_COUNT] = {
+    {"br", ".br"},
+    {"gzip", ".gz"},
+};
+
+/* Metadata of the most recently requested static files, so repeat requests
+ * skip the bundle search and every SPIFFS stat() (one per variant). Entries
+ * are dropped when storage_generation moves, i.e. on any firmware write */
+#define FILE_META_CACHE_SIZE 16
+
+/* Larger files are streamed from storage every time */
+#define RESP_CACHE_ENTRY_MAX (RESP_CACHE_BUDGET / 4)
+
+/* Finds a static file in the asset bundle, then on SPIFFS.
+ * filename is the path relative to the base path (it points into filepath) */
+static bool static_file_lookup(const char *filepath, const char *filename, struct static_file *file)
+{
+    const struct webui_bundle_entry *entry = webui_bundle_find(filename);
+    if (entry)
+    {
+        file->data = webui_bundle_data(entry);
+        file->size = entry->size;
+        file->hash = entry->hash;
+        file->hashed = true;
+        return true;
+    }
+
+    struct stat file_stat;
+    if (stat(filepath, &file_stat) == 0)
+    {
+        file->data = NULL;
+        file->size = file_stat.st_size;
+        file->mtime = file_stat.st_mtime;
+        file->hash = 0;
+        file->hashed = false;
+        return true;
+    }
+    return false;
+}
+
+static struct file_meta file_meta_cache[FILE_META_CACHE_SIZE];
+static uint32_t file_meta_clock = 0;
+
+static struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+} file_meta_stats;
+
+/* Workers look up and fill the cache concurrently */
+static SemaphoreHandle_t file_meta_lock = NULL;
+
+static SemaphoreHandle_t resp_cache_lock = NULL;
+
+esp_err_t init_file_cache(void)
+{
+    file_meta_lock = xSemaphoreCreateMutex();
+    resp_cache_lock = xSemaphoreCreateMutex();
+    return file_meta_lock && resp_cache_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/* Returns the valid cache slot for path, called with file_meta_lock held */
+static struct file_meta *file_meta_find_locked(const char *path, unsigned int generation)
+{
+    for (int i = 0; i < FILE_META_CACHE_SIZE; i++)
+    {
+        if (file_meta_cache[i].path[0] && file_meta_cache[i].generation == generation &&
+            strcmp(file_meta_cache[i].path, path) == 0)
+        {
+            return &file_meta_cache[i];
+        }
+    }
+    return NULL;
+}
+
+bool file_meta_get(char *filepath, size_t pathsize, const char *filename, struct file_meta *meta)
+{
+    const unsigned int generation = storage_generation();
+    const bool cacheable = strlen(filename) < FILE_META_PATH_MAX;
+
+    if (cacheable)
+    {
+        xSemaphoreTake(file_meta_lock, portMAX_DELAY);
+        struct file_meta *cached = file_meta_find_locked(filename, generation);
+        if (cached)
+        {
+            cached->last_used = ++file_meta_clock;
+            *meta = *cached;
+            file_meta_stats.hits++;
+            xSemaphoreGive(file_meta_lock);
+            return true;
+        }
+        file_meta_stats.misses++;
+        xSemaphoreGive(file_meta_lock);
+    }
+
+    memset(meta, 0, sizeof(*meta));
+    meta->generation = generation;
+    meta->content_type = content_type_from_file(filename);
+
+    const size_t pathlen = strlen(filepath);
+    bool found = false;
+    for (int v = 0; v < STATIC_FILE_VARIANTS; v++)
+    {
+        const char *suffix = v ? content_encodings[v - 1].suffix : "";
+        if (pathlen + strlen(suffix) + 1 > pathsize)
+        {
+            continue;
+        }
+        strcpy(filepath + pathlen, suffix);
+
+        struct static_file file;
+        if (static_file_lookup(filepath, filename, &file))
+        {
+            meta->variants[v] = (struct file_meta_variant){
+                .exists = true,
+                .hashed = file.hashed,
+                .data = file.data,
+                .size = file.size,
+                .mtime = file.mtime,
+                .hash = file.hash,
+            };
+            found = true;
+        }
+    }
+    filepath[pathlen] = '\0';
+
+    if (!found || !cacheable)
+    {
+        return found;
+    }
+
+    /* Reuse the slot of an older generation of this path, else a free
+     * slot, else evict the least recently used one */
+    xSemaphoreTake(file_meta_lock, portMAX_DELAY);
+    struct file_meta *slot = NULL;
+    for (int i = 0; i < FILE_META_CACHE_SIZE && !(slot && slot->path[0] == '\0'); i++)
+    {
+        struct file_meta *m = &file_meta_cache[i];
+        if (m->path[0] && strcmp(m->path, filename) == 0)
+        {
+            slot = m;
+            break;
+        }
+        if (!slot || m->path[0] == '\0' || m->last_used < slot->last_used)
+        {
+            slot = m;
+        }
+    }
+    if (slot->path[0] && strcmp(slot->path, filename) != 0)
+    {
+        file_meta_stats.evictions++;
+    }
+    *slot = *meta;
+    strlcpy(slot->path, filename, sizeof(slot->path));
+    slot->last_used = ++file_meta_clock;
+    *meta = *slot;
+    xSemaphoreGive(file_meta_lock);
+    return true;
+}
+
+static void file_meta_set_hash(const char *filename, const struct file_meta *meta, int variant, uint64_t hash)
+{
+    xSemaphoreTake(file_meta_lock, portMAX_DELAY);
+    struct file_meta *cached = file_meta_find_locked(filename, meta->generation);
+    if (cached && cached->variants[variant].size == meta->variants[variant].size &&
+        cached->variants[variant].mtime == meta->variants[variant].mtime)
+    {
+        cached->variants[variant].hash = hash;
+        cached->variants[variant].hashed = true;
+    }
+    xSemaphoreGive(file_meta_lock);
+}
+
+esp_err_t static_file_hash(const char *filepath, const char *filename, const struct file_meta *meta,
+                           struct static_file *file, char *scratch, size_t scratch_size)
+{
+    if (file->hashed)
+    {
+        return ESP_OK;
+    }
+
+    FILE *fd = fopen(filepath, "r");
+    if (!fd)
+    {
+        return ESP_FAIL;
+    }
+    uint64_t hash = FNV64_OFFSET_BASIS;
+    size_t len;
+    while ((len = fread(scratch, 1, scratch_size, fd)) > 0)
+    {
+        hash = fnv1a64_update(hash, scratch, len);
+    }
+    fclose(fd);
+
+    file->hash = hash;
+    file->hashed = true;
+    file_meta_set_hash(filename, meta, file->variant, hash);
+    return ESP_OK;
+}
+
+void file_meta_write_stats(struct json_writer *j)
+{
+    int entries = 0;
+
+    xSemaphoreTake(file_meta_lock, portMAX_DELAY);
+    const unsigned int generation = storage_generation();
+    for (int i = 0; i < FILE_META_CACHE_SIZE; i++)
+    {
+        if (file_meta_cache[i].path[0] && file_meta_cache[i].generation == generation)
+        {
+            entries++;
+        }
+    }
+    json_object_begin(j, "meta");
+    json_int(j, "hits", file_meta_stats.hits);
+    json_int(j, "misses", file_meta_stats.misses);
+    json_int(j, "evictions", file_meta_stats.evictions);
+    json_int(j, "entries", entries);
+    json_int(j, "capacity", FILE_META_CACHE_SIZE);
+    json_object_end(j);
+    xSemaphoreGive(file_meta_lock);
+}
+
+struct resp_cache_entry
+{
+    struct resp_cache_entry *next;
+    int refs;                    /* The cache's own reference plus one per response being sent */
+    char path[FILE_PATH_MAX];    /* Full path of the variant on storage */
+    unsigned int generation;     /* storage_generation when read */
+    uint32_t last_used;
+    size_t size;
+    time_t mtime;
+    uint64_t hash;
+    char data[];
+};
+
+static struct resp_cache_entry *resp_cache = NULL;
+static size_t resp_cache_used = 0;
+static uint32_t resp_cache_clock = 0;
+
+static struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+} resp_cache_stats;
+
+
+void resp_cache_release(struct resp_cache_entry *entry)
+{
+    if (!entry)
+    {
+        return;
+    }
+    xSemaphoreTake(resp_cache_lock, portMAX_DELAY);
+    const bool last = --entry->refs == 0;
+    xSemaphoreGive(resp_cache_lock);
+    if (last)
+    {
+        heap_caps_free(entry);
+    }
+}
+
+/* Unlinks *link from the cache, called with resp_cache_lock held.
+ * Responses still sending from it keep it alive */
+static void resp_cache_unlink_locked(struct resp_cache_entry **link)
+{
+    struct resp_cache_entry *entry = *link;
+    *link = entry->next;
+    resp_cache_used -= sizeof(*entry) + entry->size;
+    if (--entry->refs == 0)
+    {
+        heap_caps_free(entry);
+    }
+}
+
+/* Drops entries read before the last storage change, and then the least
+ * recently used ones until size more bytes fit in the budget. Called with
+ * resp_cache_lock held */
+static void resp_cache_make_room_locked(size_t size, unsigned int generation)
+{
+    for (struct resp_cache_entry **link = &resp_cache; *link;)
+    {
+        if ((*link)->generation != generation)
+        {
+            resp_cache_unlink_locked(link);
+        }
+        else
+        {
+            link = &(*link)->next;
+        }
+    }
+
+    while (resp_cache && resp_cache_used + size > RESP_CACHE_BUDGET)
+    {
+        struct resp_cache_entry **lru = &resp_cache;
+        for (struct resp_cache_entry **link = &resp_cache; *link; link = &(*link)->next)
+        {
+            if ((*link)->last_used < (*lru)->last_used)
+            {
+                lru = link;
+            }
+        }
+        resp_cache_unlink_locked(lru);
+        resp_cache_stats.evictions++;
+    }
+}
+
+void resp_cache_invalidate(void)
+{
+    xSemaphoreTake(resp_cache_lock, portMAX_DELAY);
+    resp_cache_make_room_locked(0, storage_generation());
+    xSemaphoreGive(resp_cache_lock);
+}
+
+/* Returns the current entry for filepath at size and mtime, referenced
+ * for the caller, or NULL. Called with resp_cache_lock held */
+static struct resp_cache_entry *resp_cache_find_locked(const char *filepath, size_t size, time_t mtime,
+                                                       unsigned int generation)
+{
+    for (struct resp_cache_entry *entry = resp_cache; entry; entry = entry->next)
+    {
+        if (entry->generation == generation && entry->size == size && entry->mtime == mtime &&
+            strcmp(entry->path, filepath) == 0)
+        {
+            entry->refs++;
+            entry->last_used = ++resp_cache_clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+struct resp_cache_entry *resp_cache_lookup(const char *filepath, struct static_file *file)
+{
+    const unsigned int generation = storage_generation();
+
+    xSemaphoreTake(resp_cache_lock, portMAX_DELAY);
+    struct resp_cache_entry *entry = resp_cache_find_locked(filepath, file->size, file->mtime, generation);
+    if (entry)
+    {
+        resp_cache_stats.hits++;
+    }
+    else
+    {
+        resp_cache_stats.misses++;
+    }
+    xSemaphoreGive(resp_cache_lock);
+
+    if (entry)
+    {
+        file->data = entry->data;
+        file->hash = entry->hash;
+        file->hashed = true;
+    }
+    return entry;
+}
+
+struct resp_cache_entry *resp_cache_fill(const char *filepath, const char *filename,
+                                            const struct file_meta *meta, struct static_file *file)
+{
+    const unsigned int generation = storage_generation();
+
+    if (file->size > RESP_CACHE_ENTRY_MAX)
+    {
+        return NULL;
+    }
+    struct resp_cache_entry *entry = heap_caps_malloc(sizeof(*entry) + file->size, RESP_CACHE_CAPS);
+    if (!entry)
+    {
+        return NULL;
+    }
+    FILE *fd = fopen(filepath, "r");
+    const size_t len = fd ? fread(entry->data, 1, file->size, fd) : 0;
+    if (fd)
+    {
+        fclose(fd);
+    }
+    if (len != file->size)
+    {
+        heap_caps_free(entry);
+        return NULL;
+    }
+
+    strlcpy(entry->path, filepath, sizeof(entry->path));
+    entry->generation = generation;
+    entry->size = file->size;
+    entry->mtime = file->mtime;
+    entry->hash = fnv1a64_update(FNV64_OFFSET_BASIS, entry->data, entry->size);
+    entry->refs = 2; /* One for the cache, one for the caller */
+    if (!file->hashed)
+    {
+        file_meta_set_hash(filename, meta, file->variant, entry->hash);
+    }
+
+    /* Another request may have filled it while this one was reading */
+    xSemaphoreTake(resp_cache_lock, portMAX_DELAY);
+    struct resp_cache_entry *existing = resp_cache_find_locked(filepath, entry->size, entry->mtime, generation);
+    if (!existing)
+    {
+        resp_cache_make_room_locked(sizeof(*entry) + entry->size, generation);
+        entry->last_used = ++resp_cache_clock;
+        entry->next = resp_cache;
+        resp_cache = entry;
+        resp_cache_used += sizeof(*entry) + entry->size;
+    }
+    xSemaphoreGive(resp_cache_lock);
+    if (existing)
+    {
+        heap_caps_free(entry);
+        entry = existing;
+    }
+
+    file->data = entry->data;
+    file->hash = entry->hash;
+    file->hashed = true;
+    return entry;
+}
+
+void resp_cache_write_stats(struct json_writer *j)
+{
+    int entries = 0;
+
+    xSemaphoreTake(resp_cache_lock, portMAX_DELAY);
+    for (const struct resp_cache_entry *e = resp_cache; e; e = e->next)
+    {
+        entries++;
+    }
+    json_object_begin(j, "response");
+    json_int(j, "hits", resp_cache_stats.hits);
+    json_int(j, "misses", resp_cache_stats.misses);
+    json_int(j, "evictions", resp_cache_stats.evictions);
+    json_int(j, "entries", entries);
+    json_int(j, "bytes", resp_cache_used);
+    json_int(j, "budget", RESP_CACHE_BUDGET);
+    json_int(j, "entry_max", RESP_CACHE_ENTRY_MAX);
+    json_bool(j, "psram", RESP_CACHE_CAPS == MALLOC_CAP_SPIRAM);
+    json_object_end(j);
+    xSemaphoreGive(resp_cache_lock);
+}
@@ -0,0 +1,119 @@
+/* Caches in front of the static file server: metadata of recently
+ * requested files, so repeat requests skip the bundle search and the
+ * storage stat() of every variant, and the contents of small hot ones */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "json_writer.h"
+
+/* Precompressed variants produced by tools/webui_build.py, in order of preference */
+struct content_encoding
+{
+    const char *token;  /* Accept-Encoding / Content-Encoding token */
+    const char *suffix; /* Suffix of the variant file on storage */
+};
+
+#define CONTENT_ENCODING_COUNT 2
+
+extern const struct content_encoding content_encodings[CONTENT_ENCODING_COUNT];
+
+/* Variants of a static file: the file itself, then one per content_encodings entry */
+#define STATIC_FILE_VARIANTS (1 + CONTENT_ENCODING_COUNT)
+
+/* A static file resolved for sending */
+struct static_file
+{
+    const char *data;     /* Mapped bundle or response cache contents, NULL to stream from storage */
+    size_t size;          /* Size in bytes */
+    time_t mtime;         /* Modification time of SPIFFS files (CONFIG_SPIFFS_USE_MTIME) */
+    uint64_t hash;        /* Content hash the ETag is built from */
+    bool hashed;          /* hash is valid */
+    int variant;          /* Index into file_meta.variants */
+    const char *encoding; /* Content-Encoding of a precompressed variant, or NULL */
+
+    /* Response headers */
+    const char *content_type;
+    const char *cache_control;
+    char etag[20]; /* Empty if the file could not be hashed */
+};
+
+/* Longer request paths are looked up every time */
+#define FILE_META_PATH_MAX 64
+
+struct file_meta_variant
+{
+    bool exists;
+    bool hashed;      /* hash is valid; always true for bundle entries */
+    const char *data; /* Location in the mapped bundle, NULL for SPIFFS */
+    size_t size;
+    time_t mtime;
+    uint64_t hash;
+};
+
+struct file_meta
+{
+    char path[FILE_META_PATH_MAX]; /* Requested path relative to the base path, empty if unused */
+    unsigned int generation;       /* storage_generation when looked up */
+    uint32_t last_used;
+    const char *content_type;
+    struct file_meta_variant variants[STATIC_FILE_VARIANTS];
+};
+
+esp_err_t init_file_cache(void);
+
+/* Fills meta for the file at filepath (filename is the part after the base
+ * path and points into filepath), from the cache or by looking up every
+ * variant. Returns false if no variant exists */
+bool file_meta_get(char *filepath, size_t pathsize, const char *filename, struct file_meta *meta);
+
+/* Fills file->hash for a SPIFFS file that has none yet, hashing its
+ * contents through the given buffer and caching the result */
+esp_err_t static_file_hash(const char *filepath, const char *filename, const struct file_meta *meta,
+                           struct static_file *file, char *scratch, size_t scratch_size);
+
+/* Writes the cache counters as the "meta" member of j */
+void file_meta_write_stats(struct json_writer *j);
+
+/* Response cache: whole bodies of small, hot storage files (each
+ * precompressed variant separately) kept in RAM so repeat requests are
+ * sent straight from memory like bundle entries. Uses PSRAM when the board
+ * has it, otherwise a slice of internal RAM */
+#if CONFIG_SPIRAM
+#define RESP_CACHE_BUDGET (1024 * 1024)
+#define RESP_CACHE_CAPS MALLOC_CAP_SPIRAM
+#else
+#define RESP_CACHE_BUDGET (48 * 1024)
+#define RESP_CACHE_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+/* A cached response body, referenced while a response is sent from it */
+struct resp_cache_entry;
+
+/* Drops a reference from resp_cache_lookup() or resp_cache_fill(), NULL is ignored */
+void resp_cache_release(struct resp_cache_entry *entry);
+
+/* Frees the entries read before the last storage change right away,
+ * rather than when the space is next needed */
+void resp_cache_invalidate(void);
+
+/* Points file->data at the cached copy of the storage file at filepath if
+ * there is one. Returns the referenced entry, to be released once the
+ * response is sent, or NULL on a miss */
+struct resp_cache_entry *resp_cache_lookup(const char *filepath, struct static_file *file);
+
+/* Reads the storage file at filepath into a new cache entry and points
+ * file->data at it. If another request cached the file meanwhile, that
+ * entry is used and the read is discarded. Only called for a response that sends the body, so a
+ * 304 never fills the cache. Returns the referenced entry, to be released
+ * once the response is sent, or NULL if the file is not cacheable and has
+ * to be streamed */
+struct resp_cache_entry *resp_cache_fill(const char *filepath, const char *filename,
+                                            const struct file_meta *meta, struct static_file *file);
+
+/* Writes the cache counters as the "response" member of j */
+void resp_cache_write_stats(struct json_writer *j);
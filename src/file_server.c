@@ -0,0 +1,457 @@
+/* Static file responses, see file_server.h */
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "dir_listing.h"
+#include "file_cache.h"
+#include "file_server.h"
+#include "http_util.h"
+#include "http_workers.h"
+#include "storage.h"
+
+static const char *TAG_HTTP = "HTTP Server";
+
+/* Static files are written to the socket in pieces of this size, so each
+ * write fills the lwIP TCP send buffer in one go */
+#define SEND_WRITE_SIZE CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+
+/* Max length of the header block of a static file response */
+#define STATIC_RESP_HDR_MAX 384
+
+const char *get_path_from_uri(char *dest, const char *base_path, const char *uri, size_t destsize)
+{
+    const size_t base_pathlen = strlen(base_path);
+    size_t pathlen = strlen(uri);
+
+    const char *quest = strchr(uri, '?');
+    if (quest)
+    {
+        size_t quest_len = quest - uri;
+        if (quest_len < pathlen)
+            pathlen = quest_len;
+    }
+    const char *hash = strchr(uri, '#');
+    if (hash)
+    {
+        size_t hash_len = hash - uri;
+        if (hash_len < pathlen)
+            pathlen = hash_len;
+    }
+
+    if (base_pathlen + pathlen + 1 > destsize)
+    {
+        /* Full path string won't fit into destination buffer */
+        return NULL;
+    }
+
+    /* Construct full path (base + path) */
+    strcpy(dest, base_path);
+    strlcpy(dest + base_pathlen, uri, pathlen + 1);
+
+    /* Return pointer to path, skipping the base */
+    return dest + base_pathlen;
+}
+
+/* Cache-Control policy per path, first match wins. A leading '*' matches
+ * by suffix, a trailing '*' by prefix, anything else must match exactly.
+ * "no-cache" still lets clients keep the file but makes them revalidate
+ * it with If-None-Match, which costs a header-only 304 round trip */
+static const struct
+{
+    const char *pattern;
+    const char *cache_control;
+} cache_policies[] = {
+    {"*.html", "no-cache"},
+    {"*.css", "public, max-age=3600"},
+    {"*.js", "public, max-age=3600"},
+    {"*.ico", "public, max-age=86400"},
+    {"*.png", "public, max-age=86400"},
+    {"*", "no-cache"},
+};
+
+static const char *cache_control_for_path(const char *path)
+{
+    const size_t pathlen = strlen(path);
+
+    for (int i = 0; i < sizeof(cache_policies) / sizeof(cache_policies[0]); i++)
+    {
+        const char *pattern = cache_policies[i].pattern;
+        const size_t patlen = strlen(pattern);
+
+        if (pattern[0] == '*')
+        {
+            if (pathlen >= patlen - 1 && strcmp(path + pathlen - (patlen - 1), pattern + 1) == 0)
+            {
+                return cache_policies[i].cache_control;
+            }
+        }
+        else if (pattern[patlen - 1] == '*')
+        {
+            if (strncmp(path, pattern, patlen - 1) == 0)
+            {
+                return cache_policies[i].cache_control;
+            }
+        }
+        else if (strcmp(path, pattern) == 0)
+        {
+            return cache_policies[i].cache_control;
+        }
+    }
+    return "no-cache";
+}
+
+/* Picks the variant of a file to send: the first precompressed one the
+ * client accepts, else the file itself. Appends the variant's suffix to
+ * filepath and fills file. Returns false if there is nothing to send */
+static bool select_variant(httpd_req_t *req, char *filepath, const struct file_meta *meta, struct static_file *file)
+{
+    char accept[ACCEPT_ENCODING_MAX];
+    int variant = 0;
+
+    if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept, sizeof(accept)) == ESP_OK)
+    {
+        for (int v = 1; v < STATIC_FILE_VARIANTS; v++)
+        {
+            if (meta->variants[v].exists && accept_encoding_allows(accept, content_encodings[v - 1].token))
+            {
+                variant = v;
+                break;
+            }
+        }
+    }
+    if (!meta->variants[variant].exists)
+    {
+        return false;
+    }
+
+    /* file_meta_get() already checked every suffix fits */
+    if (variant)
+    {
+        strcat(filepath, content_encodings[variant - 1].suffix);
+        file->encoding = content_encodings[variant - 1].token;
+    }
+    file->variant = variant;
+    file->data = meta->variants[variant].data;
+    file->size = meta->variants[variant].size;
+    file->mtime = meta->variants[variant].mtime;
+    file->hash = meta->variants[variant].hash;
+    file->hashed = meta->variants[variant].hashed;
+    return true;
+}
+
+/* Sets the headers of a static file response through the httpd API,
+ * for responses that go out with httpd_resp_send() */
+static void static_file_set_resp_hdrs(httpd_req_t *req, const struct static_file *file)
+{
+    httpd_resp_set_type(req, file->content_type);
+    httpd_resp_set_hdr(req, "Cache-Control", file->cache_control);
+    /* Caches must key the response on Accept-Encoding as the body depends on it */
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    if (file->encoding)
+    {
+        httpd_resp_set_hdr(req, "Content-Encoding", file->encoding);
+    }
+    if (file->etag[0])
+    {
+        httpd_resp_set_hdr(req, "ETag", file->etag);
+    }
+}
+
+/* Formats the status line and headers of a static file response into buf,
+ * a 206 when range is given and a 200 otherwise. Static files are sent with
+ * Content-Length rather than chunked encoding, so headers are written by
+ * hand and go out in the same write as the start of the body. Returns the
+ * length, or 0 if buf is too small */
+static size_t static_file_format_hdrs(char *buf, size_t size, const struct static_file *file,
+                                      const struct byte_range *range)
+{
+    char content_range[48] = "";
+    size_t content_length = file->size;
+
+    if (range)
+    {
+        snprintf(content_range, sizeof(content_range), "Content-Range: bytes %u-%u/%u\r\n",
+                 (unsigned)range->start, (unsigned)range->end, (unsigned)file->size);
+        content_length = range->end - range->start + 1;
+    }
+
+    int len = snprintf(buf, size,
+                       "HTTP/1.1 %s\r\n"
+                       "Content-Type: %s\r\n"
+                       "Content-Length: %u\r\n"
+                       "%s"
+                       "Accept-Ranges: bytes\r\n"
+                       "Cache-Control: %s\r\n"
+                       "Vary: Accept-Encoding\r\n"
+                       "%s%s%s"
+                       "%s%s%s"
+                       "\r\n",
+                       range ? "206 Partial Content" : "200 OK", file->content_type, (unsigned)content_length,
+                       content_range, file->cache_control,
+                       file->encoding ? "Content-Encoding: " : "", file->encoding ? file->encoding : "",
+                       file->encoding ? "\r\n" : "",
+                       file->etag[0] ? "ETag: " : "", file->etag, file->etag[0] ? "\r\n" : "");
+    return (len > 0 && len < size) ? len : 0;
+}
+
+/* Writes all of buf to the request's socket */
+static esp_err_t static_file_send_all(httpd_req_t *req, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        int sent = httpd_send(req, buf, len);
+        if (sent < 0)
+        {
+            return ESP_FAIL;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+/* The header block and the body are separate writes when sending from the
+ * bundle; without TCP_NODELAY Nagle would hold the body back until the
+ * client ACKs the headers, which delayed ACK can stretch to 100+ ms */
+static void static_file_set_nodelay(httpd_req_t *req)
+{
+    int nodelay = 1;
+    setsockopt(httpd_req_to_sockfd(req), IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+}
+
+/* Sends a file held in memory (a mapped bundle entry or a response cache
+ * entry), or the given range of it, without a copy */
+static esp_err_t send_memory_file(httpd_req_t *req, const char *filename, const struct static_file *file,
+                                  const struct byte_range *range)
+{
+    char hdr[STATIC_RESP_HDR_MAX];
+    size_t hdr_len = static_file_format_hdrs(hdr, sizeof(hdr), file, range);
+    if (hdr_len == 0)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Response headers too long");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG_HTTP, "Sending file from memory : %s (%u bytes)", filename, (unsigned)file->size);
+    static_file_set_nodelay(req);
+    if (static_file_send_all(req, hdr, hdr_len) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    const size_t end = range ? range->end + 1 : file->size;
+    for (size_t offset = range ? range->start : 0; offset < end; offset += SEND_WRITE_SIZE)
+    {
+        size_t len = end - offset < SEND_WRITE_SIZE ? end - offset : SEND_WRITE_SIZE;
+        if (static_file_send_all(req, file->data + offset, len) != ESP_OK)
+        {
+            ESP_LOGE(TAG_HTTP, "File sending failed!");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+/* Streams a SPIFFS file, or the given range of it, through the transfer
+ * buffer chunk. The headers share the first write with the start of the
+ * file, so files up to about SEND_WRITE_SIZE go out in a single write */
+static esp_err_t send_spiffs_file(httpd_req_t *req, const char *filepath, const char *filename,
+                                  const struct static_file *file, const struct byte_range *range, char *chunk)
+{
+    _Static_assert(SEND_WRITE_SIZE <= TRANSFER_BUF_SIZE, "a write must fit into a transfer buffer");
+    _Static_assert(STATIC_RESP_HDR_MAX < SEND_WRITE_SIZE, "headers must leave room for the body");
+
+    FILE *fd = fopen(filepath, "r");
+    if (!fd)
+    {
+        ESP_LOGE(TAG_HTTP, "Failed to read existing file : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+        return ESP_FAIL;
+    }
+
+    size_t hdr_len = static_file_format_hdrs(chunk, STATIC_RESP_HDR_MAX, file, range);
+    if (hdr_len == 0)
+    {
+        fclose(fd);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Response headers too long");
+        return ESP_FAIL;
+    }
+
+    size_t remaining = file->size;
+    if (range)
+    {
+        if (fseek(fd, range->start, SEEK_SET) != 0)
+        {
+            fclose(fd);
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to seek in file");
+            return ESP_FAIL;
+        }
+        remaining = range->end - range->start + 1;
+        ESP_LOGI(TAG_HTTP, "Sending file : %s (bytes %u-%u of %u)...", filename, (unsigned)range->start,
+                 (unsigned)range->end, (unsigned)file->size);
+    }
+    else
+    {
+        ESP_LOGI(TAG_HTTP, "Sending file : %s (%u bytes)...", filename, (unsigned)file->size);
+    }
+
+    // Add debug logging for HTTP requests
+    ESP_LOGI(TAG_HTTP, "HTTP Request: %s %s", req->method == HTTP_GET ? "GET" : "POST", req->uri);
+
+    size_t fill = hdr_len;
+    do
+    {
+        // Top up the transfer buffer to one full write
+        size_t want = SEND_WRITE_SIZE - fill;
+        if (want > remaining)
+        {
+            want = remaining;
+        }
+        size_t got = fread(chunk + fill, 1, want, fd);
+        remaining -= got;
+        fill += got;
+
+        /* The headers promised file->size bytes, a short read can only be
+         * reported by dropping the connection, which returning ESP_FAIL does */
+        if (got != want || static_file_send_all(req, chunk, fill) != ESP_OK)
+        {
+            fclose(fd);
+            ESP_LOGE(TAG_HTTP, "File sending failed!");
+            return ESP_FAIL;
+        }
+        fill = 0;
+    } while (remaining > 0);
+
+    // Close file after sending complete
+    fclose(fd);
+    ESP_LOGI(TAG_HTTP, "File sending complete");
+    return ESP_OK;
+}
+
+/* Sends file, or a 304/416 for it, according to the request's conditional
+ * and Range headers. The ETag is compared before the body is touched: a
+ * storage file is only opened for a 304 when its hash is not known yet.
+ * A body that is sent goes into the response cache if it fits, *cached is
+ * set to that entry */
+static esp_err_t static_file_respond(httpd_req_t *req, const char *filepath, const char *filename,
+                                     const struct file_meta *meta, struct static_file *file,
+                                     struct resp_cache_entry **cached)
+{
+    /* Storage files need a transfer buffer, for hashing and for sending */
+    char *chunk = NULL;
+    if (!file->data)
+    {
+        chunk = transfer_buf_acquire();
+        if (!chunk)
+        {
+            ESP_LOGW(TAG_HTTP, "No free transfer buffer for %s", filename);
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_set_type(req, "text/plain");
+            httpd_resp_set_hdr(req, "Retry-After", "1");
+            httpd_resp_sendstr(req, "Server busy");
+            return ESP_FAIL;
+        }
+    }
+
+    /* Strong validator, unique per variant since each has its own content hash */
+    char if_none_match[IF_NONE_MATCH_MAX];
+    if (static_file_hash(filepath, filename, meta, file, chunk, TRANSFER_BUF_SIZE) == ESP_OK)
+    {
+        snprintf(file->etag, sizeof(file->etag), "\"%016llx\"", (unsigned long long)file->hash);
+
+        if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+            etag_matches(if_none_match, file->etag))
+        {
+            ESP_LOGI(TAG_HTTP, "Not modified : %s", filename);
+            transfer_buf_release(chunk);
+            static_file_set_resp_hdrs(req, file);
+            httpd_resp_set_status(req, "304 Not Modified");
+            return httpd_resp_send(req, NULL, 0);
+        }
+    }
+
+    /* Single byte range, ignored if If-Range names a different version */
+    struct byte_range range;
+    const struct byte_range *send_range = NULL;
+    char range_hdr[RANGE_HDR_MAX];
+    char if_range[RANGE_HDR_MAX];
+    if (httpd_req_get_hdr_value_str(req, "Range", range_hdr, sizeof(range_hdr)) == ESP_OK &&
+        (httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK ||
+         (file->etag[0] && strcmp(if_range, file->etag) == 0)))
+    {
+        int parsed = parse_byte_range(range_hdr, file->size, &range);
+        if (parsed < 0)
+        {
+            char content_range[32];
+            snprintf(content_range, sizeof(content_range), "bytes */%u", (unsigned)file->size);
+            transfer_buf_release(chunk);
+            static_file_set_resp_hdrs(req, file);
+            httpd_resp_set_hdr(req, "Content-Range", content_range);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            return httpd_resp_send(req, NULL, 0);
+        }
+        if (parsed > 0)
+        {
+            send_range = &range;
+        }
+    }
+
+    if (!file->data)
+    {
+        *cached = resp_cache_fill(filepath, filename, meta, file);
+    }
+    if (file->data)
+    {
+        transfer_buf_release(chunk);
+        return send_memory_file(req, filename, file, send_range);
+    }
+
+    esp_err_t ret = send_spiffs_file(req, filepath, filename, file, send_range, chunk);
+    transfer_buf_release(chunk);
+    return ret;
+}
+
+esp_err_t static_file_serve(httpd_req_t *req, const char *uri)
+{
+    char filepath[FILE_PATH_MAX];
+    struct static_file file = {0};
+
+    const char *filename = get_path_from_uri(filepath, ((struct file_server_data *)req->user_ctx)->base_path,
+                                             uri, sizeof(filepath));
+    if (!filename)
+    {
+        ESP_LOGE(TAG_HTTP, "Filename is too long");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
+    }
+
+    /* If name has trailing '/', respond with directory contents */
+    if (filename[strlen(filename) - 1] == '/')
+    {
+        return storage_check_ready(req) ? http_resp_dir_html(req, filepath, filename) : ESP_FAIL;
+    }
+
+    /* Metadata is cached under the requested name, so content type and
+     * caching policy follow it rather than the name of a .gz/.br variant.
+     * Bundle files are served while storage is still being mounted */
+    struct file_meta meta;
+    if (!file_meta_get(filepath, sizeof(filepath), filename, &meta) || !select_variant(req, filepath, &meta, &file))
+    {
+        if (!storage_check_ready(req))
+        {
+            return ESP_FAIL;
+        }
+        ESP_LOGE(TAG_HTTP, "Failed to stat file : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        return ESP_FAIL;
+    }
+    file.content_type = meta.content_type;
+    file.cache_control = cache_control_for_path(filename);
+
+    /* Small storage files are sent from the response cache */
+    struct resp_cache_entry *cached = file.data ? NULL : resp_cache_lookup(filepath, &file);
+    esp_err_t ret = static_file_respond(req, filepath, filename, &meta, &file, &cached);
+    resp_cache_release(cached);
+    return ret;
+}
@@ -0,0 +1,24 @@
+/* Static file responses from the asset bundle or storage: variant
+ * selection by Accept-Encoding, ETag revalidation, single byte ranges and
+ * the Content-Length send path, with small storage files going through
+ * the response cache */
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/* user_ctx of the file server's URI handlers */
+struct file_server_data
+{
+    /* Base path of file storage */
+    char base_path[32];
+};
+
+/* Copies the full path into destination buffer and returns
+ * pointer to path (skipping the preceding base path) */
+const char *get_path_from_uri(char *dest, const char *base_path, const char *uri, size_t destsize);
+
+/* Serves the file, or directory listing, at uri from the asset bundle or
+ * storage. req->user_ctx is the struct file_server_data */
+esp_err_t static_file_serve(httpd_req_t *req, const char *uri);
@@ -0,0 +1,186 @@
+/* Parsers for the HTTP request headers the file server looks at, the
+ * MIME type lookup and the content hash behind ETags, see http_util.h.
+ * Nothing here depends on ESP-IDF, so it also builds on the host */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "http_util.h"
+#include "mime_types.h"
+
+/* Must match mime_hash() in tools/gen_mime_table.py */
+static unsigned int mime_hash(const char *ext)
+{
+    uint32_t h = MIME_HASH_SEED;
+    for (; *ext; ext++)
+    {
+        h = (h ^ (uint8_t)*ext) * 0x01000193;
+    }
+    return h >> (32 - MIME_TABLE_BITS);
+}
+
+const char *content_type_from_file(const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+    const char *dot = strrchr(base ? base : filename, '.');
+    char ext[MIME_EXT_MAX];
+
+    if (dot && strlen(dot + 1) < sizeof(ext))
+    {
+        int i;
+        for (i = 0; dot[i + 1]; i++)
+        {
+            ext[i] = tolower((unsigned char)dot[i + 1]);
+        }
+        ext[i] = '\0';
+
+        const unsigned int slot = mime_hash(ext);
+        if (mime_table[slot].type && strcmp(mime_table[slot].ext, ext) == 0)
+        {
+            return mime_table[slot].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool accept_encoding_allows(const char *accept, const char *token)
+{
+    const size_t token_len = strlen(token);
+    const char *p = accept;
+
+    while (*p)
+    {
+        while (*p == ' ' || *p == ',')
+        {
+            p++;
+        }
+        const char *end = p + strcspn(p, ",");
+        const char *param = memchr(p, ';', end - p);
+        const char *name_end = param ? param : end;
+        while (name_end > p && name_end[-1] == ' ')
+        {
+            name_end--;
+        }
+
+        if ((size_t)(name_end - p) == token_len && strncasecmp(p, token, token_len) == 0)
+        {
+            /* "q=0", "q=0.0", "q=0.000" all mean "not acceptable" */
+            const char *q = param ? strstr(param, "q=") : NULL;
+            if (q && q < end && q[2] == '0' && strspn(q + 3, ".0") == (size_t)(end - q - 3))
+            {
+                return false;
+            }
+            return true;
+        }
+        p = end;
+    }
+    return false;
+}
+
+uint64_t fnv1a64_update(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len--)
+    {
+        hash ^= *p++;
+        hash *= FNV64_PRIME;
+    }
+    return hash;
+}
+
+bool etag_matches(const char *if_none_match, const char *etag)
+{
+    const size_t etag_len = strlen(etag);
+    const char *p = if_none_match;
+
+    while (*p)
+    {
+        while (*p == ' ' || *p == ',')
+        {
+            p++;
+        }
+        const char *end = p + strcspn(p, ",");
+        size_t len = end - p;
+        while (len > 0 && p[len - 1] == ' ')
+        {
+            len--;
+        }
+        if (len >= 2 && strncmp(p, "W/", 2) == 0)
+        {
+            p += 2;
+            len -= 2;
+        }
+        if ((len == 1 && *p == '*') || (len == etag_len && strncmp(p, etag, len) == 0))
+        {
+            return true;
+        }
+        p = end;
+    }
+    return false;
+}
+
+int parse_byte_range(const char *value, size_t size, struct byte_range *range)
+{
+    char *end;
+
+    if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ','))
+    {
+        return 0;
+    }
+    value += 6;
+
+    if (*value == '-')
+    {
+        /* Suffix range: the last N bytes. strtoul() would also take
+         * leading blanks and a sign */
+        if (value[1] < '0' || value[1] > '9')
+        {
+            return 0;
+        }
+        unsigned long suffix = strtoul(value + 1, &end, 10);
+        if (*end != '\0')
+        {
+            return 0;
+        }
+        if (suffix == 0 || size == 0)
+        {
+            return -1;
+        }
+        range->start = suffix < size ? size - suffix : 0;
+        range->end = size - 1;
+        return 1;
+    }
+
+    if (*value < '0' || *value > '9')
+    {
+        return 0;
+    }
+    unsigned long first = strtoul(value, &end, 10);
+    if (*end != '-')
+    {
+        return 0;
+    }
+    value = end + 1;
+
+    unsigned long last = size ? size - 1 : 0;
+    if (*value != '\0')
+    {
+        if (*value < '0' || *value > '9')
+        {
+            return 0;
+        }
+        last = strtoul(value, &end, 10);
+        if (*end != '\0' || last < first)
+        {
+            return 0;
+        }
+    }
+
+    if (first >= size)
+    {
+        return -1;
+    }
+    range->start = first;
+    range->end = last < size ? last : size - 1;
+    return 1;
+}
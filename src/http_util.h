@@ -0,0 +1,49 @@
+/* Parsers for the HTTP request headers the file server looks at, the
+ * MIME type lookup and the content hash behind ETags. Plain C without
+ * ESP-IDF dependencies */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Get HTTP response content type according to file extension, with one
+ * hash and one compare against the generated perfect hash table in
+ * mime_types.h */
+const char *content_type_from_file(const char *filename);
+
+/* Max length of the Accept-Encoding header we look at */
+#define ACCEPT_ENCODING_MAX 128
+
+/* Returns true if the Accept-Encoding header value allows the given coding.
+ * Codings explicitly disabled with "q=0" are rejected */
+bool accept_encoding_allows(const char *accept, const char *token);
+
+#define FNV64_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+/* FNV-1a 64, same function tools/webui_build.py uses for bundle entries */
+uint64_t fnv1a64_update(uint64_t hash, const void *data, size_t len);
+
+/* Max length of an If-None-Match header we look at */
+#define IF_NONE_MATCH_MAX 256
+
+/* Returns true if the If-None-Match header lists etag (or is "*").
+ * Weak comparison as required for If-None-Match, so a "W/" prefix is ignored */
+bool etag_matches(const char *if_none_match, const char *etag);
+
+/* Inclusive byte range of a 206 Partial Content response */
+struct byte_range
+{
+    size_t start;
+    size_t end;
+};
+
+/* Max length of the Range / If-Range headers we look at */
+#define RANGE_HDR_MAX 64
+
+/* Parses a single "bytes=" range for a file of the given size.
+ * Returns 1 with range filled in, 0 to ignore the header and send the whole
+ * file (malformed or multi-range requests), or -1 if the range cannot be
+ * satisfied, which is answered with 416 */
+int parse_byte_range(const char *value, size_t size, struct byte_range *range);
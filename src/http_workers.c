@@ -0,0 +1,125 @@
+/* Transfer buffer pool and async request workers, see http_workers.h */
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "http_workers.h"
+
+static const char *TAG_HTTP = "HTTP Server";
+
+#define ASYNC_WORKER_STACK_SIZE 6144
+#define ASYNC_WORKER_PRIORITY 5
+
+/* Transfer buffer pool. A set bit in transfer_buf_free marks a free
+ * buffer; acquire/release are a compare-and-swap / fetch-or on the mask */
+static char *transfer_bufs = NULL;
+static atomic_uint transfer_buf_free = 0;
+
+esp_err_t init_transfer_buf_pool(void)
+{
+    _Static_assert(TRANSFER_BUF_COUNT <= 32, "transfer buffer mask is 32 bits");
+    _Static_assert(TRANSFER_BUF_COUNT > ASYNC_WORKER_COUNT, "every worker and the server task need a buffer");
+
+    transfer_bufs = malloc(TRANSFER_BUF_COUNT * TRANSFER_BUF_SIZE);
+    if (!transfer_bufs)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    atomic_store(&transfer_buf_free, TRANSFER_BUF_COUNT == 32 ? UINT32_MAX : (1U << TRANSFER_BUF_COUNT) - 1);
+    return ESP_OK;
+}
+
+char *transfer_buf_acquire(void)
+{
+    unsigned int mask = atomic_load(&transfer_buf_free);
+    while (mask)
+    {
+        const unsigned int bit = mask & -mask;
+        /* On failure mask is reloaded with the current value */
+        if (atomic_compare_exchange_weak(&transfer_buf_free, &mask, mask & ~bit))
+        {
+            return transfer_bufs + __builtin_ctz(bit) * TRANSFER_BUF_SIZE;
+        }
+    }
+    return NULL;
+}
+
+void transfer_buf_release(char *buf)
+{
+    if (buf)
+    {
+        atomic_fetch_or(&transfer_buf_free, 1U << ((buf - transfer_bufs) / TRANSFER_BUF_SIZE));
+    }
+}
+
+struct async_req
+{
+    httpd_req_t *req;
+    esp_err_t (*handler)(httpd_req_t *req);
+};
+
+static QueueHandle_t async_req_queue = NULL;
+
+/* Counts idle workers */
+static SemaphoreHandle_t async_worker_ready = NULL;
+
+static void async_worker_task(void *arg)
+{
+    struct async_req async_req;
+
+    while (true)
+    {
+        xSemaphoreGive(async_worker_ready);
+        if (xQueueReceive(async_req_queue, &async_req, portMAX_DELAY) == pdTRUE)
+        {
+            async_req.handler(async_req.req);
+            if (httpd_req_async_handler_complete(async_req.req) != ESP_OK)
+            {
+                ESP_LOGE(TAG_HTTP, "Failed to complete async request");
+            }
+        }
+    }
+}
+
+esp_err_t start_async_workers(void)
+{
+    async_req_queue = xQueueCreate(ASYNC_WORKER_COUNT, sizeof(struct async_req));
+    async_worker_ready = xSemaphoreCreateCounting(ASYNC_WORKER_COUNT, 0);
+    if (!async_req_queue || !async_worker_ready)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < ASYNC_WORKER_COUNT; i++)
+    {
+        if (xTaskCreate(async_worker_task, "async_req_worker", ASYNC_WORKER_STACK_SIZE, NULL,
+                        ASYNC_WORKER_PRIORITY, NULL) != pdPASS)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t submit_async_req(httpd_req_t *req, esp_err_t (*handler)(httpd_req_t *req))
+{
+    if (!async_req_queue || xSemaphoreTake(async_worker_ready, 0) != pdTRUE)
+    {
+        return ESP_FAIL;
+    }
+
+    struct async_req async_req = {.handler = handler};
+    esp_err_t err = httpd_req_async_handler_begin(req, &async_req.req);
+    if (err != ESP_OK)
+    {
+        xSemaphoreGive(async_worker_ready);
+        return err;
+    }
+
+    /* Cannot block, a worker has been reserved above */
+    xQueueSend(async_req_queue, &async_req, 0);
+    return ESP_OK;
+}
@@ -0,0 +1,29 @@
+/* Transfer buffers shared by the file transfers in flight, and the worker
+ * tasks long requests (static files, uploads, scan streams) are handed to */
+#pragma once
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/* Transfer buffers, one is held by every file transfer in flight.
+ * The pool must have at least ASYNC_WORKER_COUNT + 1 buffers (the server
+ * task itself serves requests when all workers are busy) and at most 32 */
+#define TRANSFER_BUF_SIZE 8192
+#define TRANSFER_BUF_COUNT 4
+
+/* Long requests are handed to this many worker tasks, so several
+ * transfers make progress at once while the server task keeps accepting */
+#define ASYNC_WORKER_COUNT 3
+
+esp_err_t init_transfer_buf_pool(void);
+
+/* Returns a free TRANSFER_BUF_SIZE buffer, or NULL if all are in use */
+char *transfer_buf_acquire(void);
+void transfer_buf_release(char *buf);
+
+esp_err_t start_async_workers(void);
+
+/* Runs handler for req on an idle worker task. Fails without side effects
+ * when every worker is busy, in which case the caller handles req itself:
+ * a request waiting in the queue would tie up its socket doing nothing */
+esp_err_t submit_async_req(httpd_req_t *req, esp_err_t (*handler)(httpd_req_t *req));
@@ -0,0 +1,205 @@
+/* Chunked response writer and the streaming JSON writer on top of it,
+ * see json_writer.h */
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "json_writer.h"
+
+void chunk_writer_flush(struct chunk_writer *w)
+{
+    if (w->len > 0 && w->err == ESP_OK)
+    {
+        /* Without a request the output has to fit in buf */
+        w->err = w->req ? httpd_resp_send_chunk(w->req, w->buf, w->len) : ESP_ERR_NO_MEM;
+        w->chunked = true;
+    }
+    w->len = 0;
+}
+
+void chunk_writer_write(struct chunk_writer *w, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        if (w->len == w->size)
+        {
+            chunk_writer_flush(w);
+        }
+        size_t n = w->size - w->len < len ? w->size - w->len : len;
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void chunk_writer_puts(struct chunk_writer *w, const char *str)
+{
+    chunk_writer_write(w, str, strlen(str));
+}
+
+void chunk_writer_printf(struct chunk_writer *w, const char *fmt, ...)
+{
+    char tmp[64];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    if (len > 0)
+    {
+        chunk_writer_write(w, tmp, len < sizeof(tmp) ? len : sizeof(tmp) - 1);
+    }
+}
+
+void chunk_writer_put_html(struct chunk_writer *w, const char *str)
+{
+    for (; *str; str++)
+    {
+        switch (*str)
+        {
+        case '<':
+            chunk_writer_puts(w, "&lt;");
+            break;
+        case '>':
+            chunk_writer_puts(w, "&gt;");
+            break;
+        case '&':
+            chunk_writer_puts(w, "&amp;");
+            break;
+        case '"':
+            chunk_writer_puts(w, "&quot;");
+            break;
+        default:
+            chunk_writer_write(w, str, 1);
+            break;
+        }
+    }
+}
+
+/* Runs of characters that need no escaping are copied in one go */
+void chunk_writer_put_json_str(struct chunk_writer *w, const char *str)
+{
+    chunk_writer_write(w, "\"", 1);
+    while (*str)
+    {
+        const char *run = str;
+        while (*str && *str != '"' && *str != '\\' && (unsigned char)*str >= 0x20)
+        {
+            str++;
+        }
+        chunk_writer_write(w, run, str - run);
+        if (!*str)
+        {
+            break;
+        }
+        if (*str == '"' || *str == '\\')
+        {
+            char esc[2] = {'\\', *str};
+            chunk_writer_write(w, esc, 2);
+        }
+        else
+        {
+            chunk_writer_printf(w, "\\u%04x", (unsigned char)*str);
+        }
+        str++;
+    }
+    chunk_writer_write(w, "\"", 1);
+}
+
+esp_err_t chunk_writer_finish(struct chunk_writer *w)
+{
+    if (!w->chunked && w->err == ESP_OK)
+    {
+        w->err = httpd_resp_send(w->req, w->buf, w->len);
+        w->len = 0;
+        return w->err;
+    }
+    chunk_writer_flush(w);
+    if (w->err == ESP_OK)
+    {
+        w->err = httpd_resp_send_chunk(w->req, NULL, 0);
+    }
+    return w->err;
+}
+
+/* Writes the separator and the key, if any, in front of a value */
+static void json_member(struct json_writer *j, const char *key)
+{
+    if (j->has_members & (1U << j->depth))
+    {
+        chunk_writer_write(j->out, ",", 1);
+    }
+    j->has_members |= 1U << j->depth;
+    if (key)
+    {
+        chunk_writer_write(j->out, "\"", 1);
+        chunk_writer_puts(j->out, key);
+        chunk_writer_write(j->out, "\":", 2);
+    }
+}
+
+static void json_open(struct json_writer *j, const char *key, char bracket)
+{
+    json_member(j, key);
+    chunk_writer_write(j->out, &bracket, 1);
+    assert(j->depth + 1 < JSON_DEPTH_MAX);
+    j->depth++;
+    j->has_members &= ~(1U << j->depth);
+}
+
+static void json_close(struct json_writer *j, char bracket)
+{
+    chunk_writer_write(j->out, &bracket, 1);
+    j->depth--;
+}
+
+void json_object_begin(struct json_writer *j, const char *key)
+{
+    json_open(j, key, '{');
+}
+
+void json_object_end(struct json_writer *j)
+{
+    json_close(j, '}');
+}
+
+void json_array_begin(struct json_writer *j, const char *key)
+{
+    json_open(j, key, '[');
+}
+
+void json_array_end(struct json_writer *j)
+{
+    json_close(j, ']');
+}
+
+void json_str(struct json_writer *j, const char *key, const char *value)
+{
+    json_member(j, key);
+    chunk_writer_put_json_str(j->out, value);
+}
+
+void json_int(struct json_writer *j, const char *key, long long value)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    unsigned long long v = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+
+    do
+    {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+    json_member(j, key);
+    chunk_writer_write(j->out, p, tmp + sizeof(tmp) - p);
+}
+
+void json_bool(struct json_writer *j, const char *key, bool value)
+{
+    json_member(j, key);
+    chunk_writer_puts(j->out, value ? "true" : "false");
+}
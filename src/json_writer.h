@@ -0,0 +1,63 @@
+/* Chunked response writer and the streaming JSON writer on top of it */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/* Batches small pieces of a chunked response into a transfer buffer, so
+ * the socket sees one httpd_resp_send_chunk() per buffer-full rather than
+ * one per string. A writer without a request only fills buf, and fails
+ * with ESP_ERR_NO_MEM once the output does not fit */
+struct chunk_writer
+{
+    httpd_req_t *req;
+    char *buf;
+    size_t size;
+    size_t len;
+    esp_err_t err; /* First send error, later writes are dropped */
+    bool chunked;  /* Part of the response has been sent as a chunk */
+};
+
+void chunk_writer_flush(struct chunk_writer *w);
+void chunk_writer_write(struct chunk_writer *w, const char *data, size_t len);
+void chunk_writer_puts(struct chunk_writer *w, const char *str);
+void chunk_writer_printf(struct chunk_writer *w, const char *fmt, ...);
+
+/* Writes str with the characters that are special in HTML escaped */
+void chunk_writer_put_html(struct chunk_writer *w, const char *str);
+
+/* Writes str as a quoted JSON string */
+void chunk_writer_put_json_str(struct chunk_writer *w, const char *str);
+
+/* Flushes what is left and terminates the chunked response. A response
+ * that fits the buffer goes out in one send with a Content-Length */
+esp_err_t chunk_writer_finish(struct chunk_writer *w);
+
+/* Streaming JSON writer on top of a chunk writer. It tracks nesting to
+ * place the commas, so handlers only name keys and values, and escapes
+ * string values. Nothing is allocated: output goes through the chunk
+ * writer's buffer, which may live on the stack. Keys are string literals
+ * and are written as they are */
+#define JSON_DEPTH_MAX 16
+
+/* Buffer size for handlers with small, bounded responses */
+#define JSON_SMALL_BUF_SIZE 256
+
+struct json_writer
+{
+    struct chunk_writer *out;
+    uint8_t depth;
+    uint16_t has_members; /* Bit n set once the container at depth n has a member */
+};
+
+/* key is NULL for the top level value and for array elements */
+void json_object_begin(struct json_writer *j, const char *key);
+void json_object_end(struct json_writer *j);
+void json_array_begin(struct json_writer *j, const char *key);
+void json_array_end(struct json_writer *j);
+void json_str(struct json_writer *j, const char *key, const char *value);
+void json_int(struct json_writer *j, const char *key, long long value);
+void json_bool(struct json_writer *j, const char *key, bool value);
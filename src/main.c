@@ -1,12 +1,11 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_mac.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
-#include "esp_netif_net_stack.h"
 #include "esp_netif.h"
 #include "nvs_flash.h"
 #include "lwip/inet.h"
@@ -16,8 +15,22 @@
 #include "lwip/sys.h"
 #include "esp_http_server.h"
 #include "driver/gpio.h"
-#include "esp_spiffs.h"
-#include <dirent.h>
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "boot.h"
+#include "cred_store.h"
+#include "dir_listing.h"
+#include "file_cache.h"
+#include "file_server.h"
+#include "http_workers.h"
+#include "json_writer.h"
+#include "roam.h"
+#include "sta_manager.h"
+#include "storage.h"
+#include "upload.h"
+#include "webui_bundle.h"
+#include "wifi_scan.h"
+#include "cJSON.h"
 
 /* The examples use WiFi configuration that you can set via project configuration menu.
 
@@ -25,11 +38,6 @@
    the config you want - ie #define EXAMPLE_ESP_WIFI_STA_SSID "mywifissid"
 */
 
-/* STA Configuration */
-#define EXAMPLE_ESP_WIFI_STA_SSID "your_wifi_ssid"
-#define EXAMPLE_ESP_WIFI_STA_PASSWD "your_wifi_password"
-#define EXAMPLE_ESP_MAXIMUM_RETRY 5
-
 /* AP Configuration */
 #define EXAMPLE_ESP_WIFI_AP_SSID "ESP32_AP"
 #define EXAMPLE_ESP_WIFI_AP_PASSWD ""
@@ -39,59 +47,40 @@
 /* GPIO Configuration */
 #define LED_GPIO_PIN GPIO_NUM_35
 
-/* The event group allows multiple bits for each event, but we only care about two events:
- * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
-#define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT BIT1
-
-static const char *TAG_AP = "WiFi SoftAP";
 static const char *TAG_STA = "WiFi Sta";
+static const char *TAG_AP = "WiFi SoftAP";
 static const char *TAG_HTTP = "HTTP Server";
 
-static int s_retry_num = 0;
-
-/* FreeRTOS event group to signal when we are connected/disconnected */
-static EventGroupHandle_t s_wifi_event_group;
-
 /* HTTP Server handle */
 static httpd_handle_t server = NULL;
 
-/* WiFi scan results */
-static wifi_ap_record_t ap_records[20];
-static uint16_t ap_count = 0;
-static uint16_t scan_number = 0;
+/* Soft AP netif, see ap_traffic_hook() */
+static esp_netif_t *ap_netif = NULL;
 
 /* LED state */
 static bool led_state = false;
 
-static void wifi_event_handler(void *arg, esp_event_base_t event_base,
-                               int32_t event_id, void *event_data)
+/* Soft AP events, the station ones are handled by sta_manager_event_handler() */
+static void wifi_ap_event_handler(void *arg, esp_event_base_t event_base,
+                                  int32_t event_id, void *event_data)
 {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED)
+    if (event_id == WIFI_EVENT_AP_START)
+    {
+        boot_mark(BOOT_AP_STARTED);
+    }
+    else if (event_id == WIFI_EVENT_AP_STACONNECTED)
     {
         wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
         ESP_LOGI(TAG_AP, "Station " MACSTR " joined, AID=%d",
                  MAC2STR(event->mac), event->aid);
+        ap_traffic_hook(ap_netif);
     }
-    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED)
+    else if (event_id == WIFI_EVENT_AP_STADISCONNECTED)
     {
         wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
         ESP_LOGI(TAG_AP, "Station " MACSTR " left, AID=%d, reason:%d",
                  MAC2STR(event->mac), event->aid, event->reason);
     }
-    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
-    {
-        esp_wifi_connect();
-        ESP_LOGI(TAG_STA, "Station started");
-    }
-    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
-    {
-        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG_STA, "Got IP:" IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
-        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
-    }
 }
 
 /* Initialize soft AP */
@@ -126,34 +115,6 @@ esp_netif_t *wifi_init_softap(void)
     return esp_netif_ap;
 }
 
-/* Initialize wifi station */
-esp_netif_t *wifi_init_sta(void)
-{
-    esp_netif_t *esp_netif_sta = esp_netif_create_default_wifi_sta();
-
-    wifi_config_t wifi_sta_config = {
-        .sta = {
-            .ssid = EXAMPLE_ESP_WIFI_STA_SSID,
-            .password = EXAMPLE_ESP_WIFI_STA_PASSWD,
-            .scan_method = WIFI_ALL_CHANNEL_SCAN,
-            .failure_retry_cnt = EXAMPLE_ESP_MAXIMUM_RETRY,
-            /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
-             * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
-             * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
-             * WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK standards.
-             */
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-            .sae_pwe_h2e = WPA3_SAE_PWE_BOTH,
-        },
-    };
-
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_config));
-
-    ESP_LOGI(TAG_STA, "wifi_init_sta finished.");
-
-    return esp_netif_sta;
-}
-
 /* Initialize GPIO for LED */
 void gpio_init_led(void)
 {
@@ -169,387 +130,476 @@ void gpio_init_led(void)
     ESP_LOGI(TAG_HTTP, "LED GPIO initialized on pin %d", LED_GPIO_PIN);
 }
 
-/* Initialize SPIFFS */
-esp_err_t init_spiffs(void)
+/* HTTP GET handler for serving files from the asset bundle or storage */
+static esp_err_t file_get_handler(httpd_req_t *req)
 {
-    ESP_LOGI(TAG_HTTP, "Initializing SPIFFS");
-
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        .partition_label = NULL,
-        .max_files = 5,
-        .format_if_mount_failed = true};
-
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    esp_err_t err = static_file_serve(req, req->uri);
+    boot_mark(BOOT_HTTP_FIRST_RESPONSE);
+    return err;
+}
 
-    if (ret != ESP_OK)
+/* Wildcard GET handler, passes the request on to an async worker */
+static esp_err_t file_get_async_handler(httpd_req_t *req)
+{
+    if (submit_async_req(req, file_get_handler) == ESP_OK)
     {
-        if (ret == ESP_FAIL)
-        {
-            ESP_LOGE(TAG_HTTP, "Failed to mount or format filesystem");
-        }
-        else if (ret == ESP_ERR_NOT_FOUND)
-        {
-            ESP_LOGE(TAG_HTTP, "Failed to find SPIFFS partition");
-        }
-        else
-        {
-            ESP_LOGE(TAG_HTTP, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
-        }
-        return ret;
+        return ESP_OK;
     }
+    /* All workers busy, serve it from the server task */
+    return file_get_handler(req);
+}
 
-    size_t total = 0, used = 0;
-    ret = esp_spiffs_info(NULL, &total, &used);
-    if (ret != ESP_OK)
-    {
-        ESP_LOGE(TAG_HTTP, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
-    }
-    else
+/* Upload POST handler, passes the request on to an async worker so a
+ * long upload does not hold up the server task. Uploads still run one at
+ * a time, see upload_post_handler() */
+static esp_err_t upload_post_async_handler(httpd_req_t *req)
+{
+    if (submit_async_req(req, upload_post_handler) == ESP_OK)
     {
-        ESP_LOGI(TAG_HTTP, "SPIFFS partition size: total: %d, used: %d", total, used);
+        return ESP_OK;
     }
+    /* All workers busy, receive it on the server task */
+    return upload_post_handler(req);
+}
 
-    return ESP_OK;
+/* Single-file UI generated by tools/webui_build.py from WEBUI/index.html,
+ * with style.css and script.js minified and inlined, so "/" loads in one
+ * request. Set to 0 to redirect to the separate files while working on
+ * the UI, or when no ui.html has been built */
+#define WEBUI_INLINE_ENABLE 1
+#define WEBUI_INLINE_PATH "/ui.html"
+
+static esp_err_t root_get_inline_handler(httpd_req_t *req)
+{
+    esp_err_t err = static_file_serve(req, WEBUI_INLINE_PATH);
+    boot_mark(BOOT_HTTP_FIRST_RESPONSE);
+    return err;
 }
 
 /* HTTP GET handler for root page */
 static esp_err_t root_get_handler(httpd_req_t *req)
 {
+#if WEBUI_INLINE_ENABLE
+    char filepath[FILE_PATH_MAX];
+    struct file_meta meta;
+    const char *filename = get_path_from_uri(filepath, ((struct file_server_data *)req->user_ctx)->base_path,
+                                             WEBUI_INLINE_PATH, sizeof(filepath));
+    if (filename && file_meta_get(filepath, sizeof(filepath), filename, &meta))
+    {
+        ESP_LOGI(TAG_HTTP, "HTTP Request: GET / (serving %s)", WEBUI_INLINE_PATH);
+        if (submit_async_req(req, root_get_inline_handler) == ESP_OK)
+        {
+            return ESP_OK;
+        }
+        return root_get_inline_handler(req);
+    }
+#endif
+
     ESP_LOGI(TAG_HTTP, "HTTP Request: GET / (redirecting to /index.html)");
     httpd_resp_set_status(req, "302 Temporary Redirect");
     httpd_resp_set_hdr(req, "Location", "/index.html");
     httpd_resp_send(req, NULL, 0);
+    boot_mark(BOOT_HTTP_FIRST_RESPONSE);
     return ESP_OK;
 }
 
-/* Max length a file path can have on storage */
-#define FILE_PATH_MAX 256
-
-/* Scratch buffer size */
-#define SCRATCH_BUFSIZE 8192
-
-struct file_server_data
-{
-    /* Base path of file storage */
-    char base_path[32];
-
-    /* Scratch buffer for temporary storage during file transfer */
-    char scratch[SCRATCH_BUFSIZE];
-};
-
-/* Copies the full path into destination buffer and returns
- * pointer to path (skipping the preceding base path) */
-static const char *get_path_from_uri(char *dest, const char *base_path, const char *uri, size_t destsize)
+/* Name of an authmode in scan results */
+static const char *wifi_auth_mode_str(wifi_auth_mode_t authmode)
 {
-    const size_t base_pathlen = strlen(base_path);
-    size_t pathlen = strlen(uri);
-
-    const char *quest = strchr(uri, '?');
-    if (quest)
+    switch (authmode)
     {
-        size_t quest_len = quest - uri;
-        if (quest_len < pathlen)
-            pathlen = quest_len;
-    }
-    const char *hash = strchr(uri, '#');
-    if (hash)
-    {
-        size_t hash_len = hash - uri;
-        if (hash_len < pathlen)
-            pathlen = hash_len;
+    case WIFI_AUTH_OPEN:
+        return "open";
+    case WIFI_AUTH_WPA_PSK:
+        return "wpa";
+    case WIFI_AUTH_WPA2_PSK:
+        return "wpa2";
+    case WIFI_AUTH_WPA_WPA2_PSK:
+        return "wpa_wpa2";
+    case WIFI_AUTH_WPA3_PSK:
+        return "wpa3";
+    case WIFI_AUTH_WPA2_WPA3_PSK:
+        return "wpa2_wpa3";
+    default:
+        return "unknown";
     }
+}
 
-    if (base_pathlen + pathlen + 1 > destsize)
+/* Writes a scan record as a JSON object */
+static void scan_net_write_json(struct json_writer *j, const struct scan_net *net)
+{
+    char bssid[18];
+
+    snprintf(bssid, sizeof(bssid), MACSTR, MAC2STR(net->bssid));
+    json_object_begin(j, NULL);
+    json_str(j, "ssid", net->ssid);
+    json_str(j, "bssid", bssid);
+    json_int(j, "rssi", net->rssi);
+    json_int(j, "rssi_avg", net->rssi_avg);
+    json_int(j, "trend", net->trend);
+    json_str(j, "authmode", wifi_auth_mode_str(net->authmode));
+    json_int(j, "channel", net->channel);
+    json_array_begin(j, "channels");
+    for (int ch = 0; ch < 16; ch++)
     {
-        /* Full path string won't fit into destination buffer */
-        return NULL;
+        if (net->channels & (1U << ch))
+        {
+            json_int(j, NULL, ch);
+        }
     }
-
-    /* Construct full path (base + path) */
-    strcpy(dest, base_path);
-    strlcpy(dest + base_pathlen, uri, pathlen + 1);
-
-    /* Return pointer to path, skipping the base */
-    return dest + base_pathlen;
+    json_array_end(j);
+    json_int(j, "aps", net->ap_count);
+    json_object_end(j);
 }
 
-/* Send HTTP response with a run-time generated html consisting of
- * a list of all files and folders under the requested path.
- * In case of SPIFFS this returns empty list when path is any
- * string other than '/', since SPIFFS doesn't support directories */
-static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath)
+/* The "networks" array of the scan response, rendered once per state of
+ * the scan results (seq and changes) and copied into every response until
+ * they change. Arrays that do not fit in SCAN_JSON_BUF_SIZE are not kept,
+ * those responses are written record by record, and scan_json_oversize
+ * remembers the state so later polls of it skip straight to that.
+ * Protected by scan_json_lock */
+struct scan_json
 {
-    char entrypath[FILE_PATH_MAX];
-    char entrysize[16];
-    const char *entrytype;
+    int refs;         /* The cache's own reference plus one per response being sent */
+    uint32_t seq;
+    uint32_t changes;
+    size_t size;
+    char data[];
+};
 
-    struct dirent *entry;
-    struct stat entry_stat;
+/* The handler keeps its record batch at the end of its transfer buffer
+ * rather than on the httpd task's stack, the JSON goes in front of it */
+#define SCAN_JSON_BUF_SIZE ((TRANSFER_BUF_SIZE - SCAN_STREAM_BATCH * sizeof(struct scan_net)) & ~(size_t)7)
 
-    DIR *dir = opendir(dirpath);
-    const size_t dirpath_len = strlen(dirpath);
+static struct scan_json *scan_json = NULL;
+static SemaphoreHandle_t scan_json_lock = NULL;
 
-    /* Retrieve the base path of file storage to construct the full path */
-    strlcpy(entrypath, dirpath, sizeof(entrypath));
+/* The last state whose array did not fit */
+static struct
+{
+    bool valid;
+    uint32_t seq;
+    uint32_t changes;
+} scan_json_oversize;
+
+static struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t oversize; /* Polls streamed without rendering, see scan_json_oversize */
+} scan_json_stats;
 
-    if (!dir)
+static void scan_json_release(struct scan_json *entry)
+{
+    if (!entry)
     {
-        ESP_LOGE(TAG_HTTP, "Failed to stat dir : %s", dirpath);
-        /* Respond with 404 Not Found */
-        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Directory does not exist");
-        return ESP_FAIL;
+        return;
     }
+    xSemaphoreTake(scan_json_lock, portMAX_DELAY);
+    const bool last = --entry->refs == 0;
+    xSemaphoreGive(scan_json_lock);
+    if (last)
+    {
+        heap_caps_free(entry);
+    }
+}
 
-    /* Send HTML file header */
-    httpd_resp_sendstr_chunk(req, "<!DOCTYPE html><html><body>");
-
-    /* Send file-list table definition and column labels */
-    httpd_resp_sendstr_chunk(req,
-                             "<table class=\"fixed\" border=\"1\">"
-                             "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
-                             "<thead><tr><th>Name</th><th>Type</th><th>Size (Bytes)</th><th>Delete</th></tr></thead>"
-                             "<tbody>");
+/* Returns the referenced array for the scan results at seq and changes,
+ * rendering it in buf, SCAN_JSON_BUF_SIZE bytes, on a miss. batch is the
+ * caller's record batch. NULL if it does not fit or the results moved on
+ * while it was rendered */
+static struct scan_json *scan_json_get(uint32_t seq, uint32_t changes, char *buf, struct scan_net *batch)
+{
+    struct scan_json *entry = NULL;
+    bool oversize = false;
 
-    /* Iterate over all files / folders and fetch their names and sizes */
-    while ((entry = readdir(dir)) != NULL)
+    xSemaphoreTake(scan_json_lock, portMAX_DELAY);
+    if (scan_json && scan_json->seq == seq && scan_json->changes == changes)
     {
-        entrytype = (entry->d_type == DT_DIR ? "directory" : "file");
+        entry = scan_json;
+        entry->refs++;
+        scan_json_stats.hits++;
+    }
+    else if (scan_json_oversize.valid && scan_json_oversize.seq == seq && scan_json_oversize.changes == changes)
+    {
+        oversize = true;
+        scan_json_stats.oversize++;
+    }
+    else
+    {
+        scan_json_stats.misses++;
+    }
+    xSemaphoreGive(scan_json_lock);
+    if (entry || oversize)
+    {
+        return entry;
+    }
 
-        strlcpy(entrypath + dirpath_len, entry->d_name, sizeof(entrypath) - dirpath_len);
-        if (stat(entrypath, &entry_stat) == -1)
-        {
-            ESP_LOGE(TAG_HTTP, "Failed to stat %s : %s", entrytype, entry->d_name);
-            continue;
-        }
-        sprintf(entrysize, "%ld", entry_stat.st_size);
-        ESP_LOGI(TAG_HTTP, "Found %s : %s (%s bytes)", entrytype, entry->d_name, entrysize);
-
-        /* Send chunk of HTML file containing table entries with file name and size */
-        httpd_resp_sendstr_chunk(req, "<tr><td><a href=\"");
-        httpd_resp_sendstr_chunk(req, req->uri);
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        if (entry->d_type == DT_DIR)
+    /* The records as elements of a top level list, without the brackets */
+    struct chunk_writer w = {.buf = buf, .size = SCAN_JSON_BUF_SIZE};
+    struct json_writer j = {.out = &w};
+    int index = 0;
+    int n;
+    while (w.err == ESP_OK && (n = scan_cache_copy(seq, 0, &index, batch)) > 0)
+    {
+        for (int i = 0; i < n; i++)
         {
-            httpd_resp_sendstr_chunk(req, "/");
+            scan_net_write_json(&j, &batch[i]);
         }
-        httpd_resp_sendstr_chunk(req, "\">");
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        httpd_resp_sendstr_chunk(req, "</a></td><td>");
-        httpd_resp_sendstr_chunk(req, entrytype);
-        httpd_resp_sendstr_chunk(req, "</td><td>");
-        httpd_resp_sendstr_chunk(req, entrysize);
-        httpd_resp_sendstr_chunk(req, "</td><td>");
-        httpd_resp_sendstr_chunk(req, "<form method=\"post\" action=\"/delete");
-        httpd_resp_sendstr_chunk(req, req->uri);
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        httpd_resp_sendstr_chunk(req, "\"><button type=\"submit\">Delete</button></form>");
-        httpd_resp_sendstr_chunk(req, "</td></tr>\n");
-    }
-    closedir(dir);
-
-    /* Finish the file list table */
-    httpd_resp_sendstr_chunk(req, "</tbody></table>");
-
-    /* Send remaining chunk of HTML file to complete it */
-    httpd_resp_sendstr_chunk(req, "</body></html>");
-
-    /* Send empty chunk to signal HTTP response completion */
-    httpd_resp_sendstr_chunk(req, NULL);
-    return ESP_OK;
-}
-
-/* Set HTTP response content type according to file extension */
-static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename)
-{
-    if (strstr(filename, ".html"))
+    }
+    struct scan_status status;
+    wifi_scan_status(&status);
+    const bool current = status.seq == seq && status.changes == changes;
+    if (w.err != ESP_OK && current)
     {
-        return httpd_resp_set_type(req, "text/html");
+        xSemaphoreTake(scan_json_lock, portMAX_DELAY);
+        scan_json_oversize.valid = true;
+        scan_json_oversize.seq = seq;
+        scan_json_oversize.changes = changes;
+        xSemaphoreGive(scan_json_lock);
     }
-    else if (strstr(filename, ".css"))
+    if (w.err != ESP_OK || !current)
     {
-        return httpd_resp_set_type(req, "text/css");
+        return NULL;
     }
-    else if (strstr(filename, ".js"))
+
+    entry = heap_caps_malloc(sizeof(*entry) + w.len, RESP_CACHE_CAPS);
+    if (!entry)
     {
-        return httpd_resp_set_type(req, "application/javascript");
+        return NULL;
     }
-    /* This is a limited set only */
-    /* For any other type always set as plain text */
-    return httpd_resp_set_type(req, "text/plain");
+    entry->refs = 2; /* One for the cache, one for the caller */
+    entry->seq = seq;
+    entry->changes = changes;
+    entry->size = w.len;
+    memcpy(entry->data, buf, w.len);
+
+    xSemaphoreTake(scan_json_lock, portMAX_DELAY);
+    struct scan_json *old = scan_json;
+    scan_json = entry;
+    xSemaphoreGive(scan_json_lock);
+    scan_json_release(old);
+    return entry;
 }
 
-/* HTTP GET handler for serving files from SPIFFS */
-static esp_err_t file_get_handler(httpd_req_t *req)
+/* HTTP GET handler for WiFi scan results. Answers right away from the
+ * last completed scan; "?refresh=1", or having no results yet, also starts
+ * a new scan in the background. Clients poll while "scanning" is true.
+ * The records are written straight to the socket through a transfer
+ * buffer, so any number of networks takes the same memory. Repeat polls
+ * of unchanged results copy the array from scan_json instead */
+static esp_err_t wifi_scan_get_handler(httpd_req_t *req)
 {
-    char filepath[FILE_PATH_MAX];
-    FILE *fd = NULL;
-    struct stat file_stat;
+    char query[32];
+    char param[8];
+    bool refresh = false;
 
-    const char *filename = get_path_from_uri(filepath, ((struct file_server_data *)req->user_ctx)->base_path,
-                                             req->uri, sizeof(filepath));
-    if (!filename)
-    {
-        ESP_LOGE(TAG_HTTP, "Filename is too long");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
-        return ESP_FAIL;
-    }
-
-    /* If name has trailing '/', respond with directory contents */
-    if (filename[strlen(filename) - 1] == '/')
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "refresh", param, sizeof(param)) == ESP_OK)
     {
-        return http_resp_dir_html(req, filepath);
+        refresh = strcmp(param, "0") != 0;
     }
 
-    if (stat(filepath, &file_stat) == -1)
+    struct scan_status status;
+    wifi_scan_status(&status);
+    if (refresh || status.done_us == 0)
     {
-        ESP_LOGE(TAG_HTTP, "Failed to stat file : %s", filepath);
-        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
-        return ESP_FAIL;
+        esp_err_t err = wifi_scan_request(false);
+        if (err != ESP_OK)
+        {
+            /* E.g. while the station is connecting, the cached results still stand */
+            ESP_LOGW(TAG_HTTP, "WiFi scan not started (%s)", esp_err_to_name(err));
+        }
     }
 
-    fd = fopen(filepath, "r");
-    if (!fd)
+    char *buf = transfer_buf_acquire();
+    if (!buf)
     {
-        ESP_LOGE(TAG_HTTP, "Failed to read existing file : %s", filepath);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_sendstr(req, "Server busy");
         return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG_HTTP, "Sending file : %s (%ld bytes)...", filename, file_stat.st_size);
-    set_content_type_from_file(req, filename);
+    wifi_scan_status(&status);
+    const uint32_t seq = status.seq;
+    const uint32_t changes = status.changes;
+    const bool scanning = status.in_progress;
+    const int64_t done_us = status.done_us;
+    const struct scan_stats last = status.last;
 
-    // Add debug logging for HTTP requests
-    ESP_LOGI(TAG_HTTP, "HTTP Request: %s %s", req->method == HTTP_GET ? "GET" : "POST", req->uri);
+    struct scan_net *batch = (struct scan_net *)(buf + SCAN_JSON_BUF_SIZE);
+    struct scan_json *cached = scan_json_get(seq, changes, buf, batch);
 
-    // Retrieve the pointer to scratch buffer for temporary storage
-    char *chunk = ((struct file_server_data *)req->user_ctx)->scratch;
-    size_t chunksize;
-    do
+    httpd_resp_set_type(req, "application/json");
+    struct chunk_writer w = {.req = req, .buf = buf, .size = SCAN_JSON_BUF_SIZE};
+    struct json_writer j = {.out = &w};
+    json_object_begin(&j, NULL);
+    json_bool(&j, "scanning", scanning);
+    json_int(&j, "age_ms", done_us ? (esp_timer_get_time() - done_us) / 1000 : -1);
+    json_object_begin(&j, "last_scan");
+    json_bool(&j, "sliced", last.sliced);
+    json_int(&j, "duration_ms", last.duration_ms);
+    json_int(&j, "slices", last.slices);
+    json_int(&j, "deferred", last.deferred);
+    json_int(&j, "ap_bytes", last.ap_bytes);
+    json_object_end(&j);
+    json_array_begin(&j, "networks");
+
+    if (cached)
     {
-        // Read file in chunks into the scratch buffer
-        chunksize = fread(chunk, 1, SCRATCH_BUFSIZE, fd);
-
-        if (chunksize > 0)
+        chunk_writer_write(&w, cached->data, cached->size);
+    }
+    else
+    {
+        /* Stops early if a scan completes meanwhile, rather than mixing two */
+        int index = 0;
+        int n;
+        while (w.err == ESP_OK && (n = scan_cache_copy(seq, 0, &index, batch)) > 0)
         {
-            // Send the buffer contents as HTTP response chunk
-            if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK)
+            for (int i = 0; i < n; i++)
             {
-                fclose(fd);
-                ESP_LOGE(TAG_HTTP, "File sending failed!");
-                httpd_resp_sendstr_chunk(req, NULL);
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-                return ESP_FAIL;
+                scan_net_write_json(&j, &batch[i]);
             }
         }
-    } while (chunksize != 0);
-
-    // Close file after sending complete
-    fclose(fd);
-    ESP_LOGI(TAG_HTTP, "File sending complete");
-
-    // Respond with an empty chunk to signal HTTP response completion
-    httpd_resp_send_chunk(req, NULL, 0);
-    return ESP_OK;
+    }
+    json_array_end(&j);
+    json_object_end(&j);
+    esp_err_t err = chunk_writer_finish(&w);
+    transfer_buf_release(buf);
+    scan_json_release(cached);
+
+    ESP_LOGI(TAG_HTTP, "WiFi scan results sent, %s", cached ? "cached" : "rendered");
+    return err;
 }
 
-/* HTTP GET handler for WiFi scan */
-static esp_err_t wifi_scan_get_handler(httpd_req_t *req)
-{
-    ESP_LOGI(TAG_HTTP, "WiFi scan requested");
-
-    // Perform WiFi scan
-    wifi_scan_config_t scan_config = {
-        .ssid = NULL,
-        .bssid = NULL,
-        .channel = 0,
-        .show_hidden = false,
-        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
-        .scan_time.active.min = 100,
-        .scan_time.active.max = 300,
-    };
+/* How often the stream handler looks for new records while a walk runs */
+#define SCAN_STREAM_POLL_MS 50
 
-    ESP_ERROR_CHECK(esp_wifi_scan_start(&scan_config, true));
+/* Streams a channel-by-channel scan as Server-Sent Events: a "networks"
+ * event with the networks found or updated by each channel as soon as it
+ * has been scanned, "progress" events as the walk moves on and a final
+ * "done". A network seen again on a later channel is sent again, and
+ * replaces the earlier record of the same SSID. Joins a scan that is
+ * already running. Runs on an async worker for the length of the scan */
+static esp_err_t wifi_scan_stream_handler(httpd_req_t *req)
+{
+    struct scan_net batch[SCAN_STREAM_BATCH];
+    uint8_t reported_channel = 0;
+    int count = 0;
 
-    // Get scan results
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&scan_number));
-    if (scan_number > 20)
+    char *buf = transfer_buf_acquire();
+    if (!buf)
     {
-        scan_number = 20;
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_sendstr(req, "Server busy");
+        return ESP_FAIL;
     }
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&scan_number, ap_records));
-    ap_count = scan_number;
-
-    // Create JSON response
-    char *json_response = NULL;
-    size_t json_size = 0;
 
-    // Calculate buffer size needed
-    json_size += 20; // {"networks":[]}
-    for (int i = 0; i < ap_count && i < 20; i++)
+    esp_err_t err = wifi_scan_request(true);
+    if (err != ESP_OK)
     {
-        json_size += 150; // Rough estimate per network (increased for channel)
+        /* Nothing running, the cached results are streamed instead */
+        ESP_LOGW(TAG_HTTP, "WiFi scan not started (%s)", esp_err_to_name(err));
     }
 
-    json_response = malloc(json_size);
-    if (!json_response)
-    {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Memory allocation failed");
-        return ESP_FAIL;
-    }
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    struct chunk_writer w = {.req = req, .buf = buf, .size = TRANSFER_BUF_SIZE};
 
-    strcpy(json_response, "{\"networks\":[");
+    uint32_t seq = 0;
+    uint32_t since = 0;
+    bool restart = true;
 
-    for (int i = 0; i < ap_count && i < 20; i++)
+    while (w.err == ESP_OK)
     {
-        char network_entry[250];
-        char auth_str[20];
+        struct scan_status status;
+        wifi_scan_status(&status);
+        const bool scanning = status.in_progress;
+        const uint8_t channel = status.walk_channel;
+        const uint8_t last = status.walk_last;
+        const uint32_t changes = status.changes;
+        count = status.count;
+        if (restart)
+        {
+            seq = status.seq;
+        }
 
-        // Convert authmode to string
-        switch (ap_records[i].authmode)
+        /* Everything modified since the last round. Records modified
+         * while this runs are picked up again by the next one */
+        struct json_writer j = {.out = &w};
+        int index = 0;
+        int sent = 0;
+        int n = 0;
+        while (w.err == ESP_OK && (n = scan_cache_copy(seq, since, &index, batch)) > 0)
+        {
+            if (sent == 0)
+            {
+                chunk_writer_puts(&w, "event: networks\ndata: ");
+                json_object_begin(&j, NULL);
+                json_array_begin(&j, "networks");
+            }
+            for (int i = 0; i < n; i++)
+            {
+                scan_net_write_json(&j, &batch[i]);
+            }
+            sent += n;
+        }
+        if (sent)
+        {
+            json_array_end(&j);
+            json_object_end(&j);
+            chunk_writer_puts(&w, "\n\n");
+        }
+        if (n < 0)
         {
-        case WIFI_AUTH_OPEN:
-            strcpy(auth_str, "open");
-            break;
-        case WIFI_AUTH_WPA_PSK:
-            strcpy(auth_str, "wpa");
-            break;
-        case WIFI_AUTH_WPA2_PSK:
-            strcpy(auth_str, "wpa2");
-            break;
-        case WIFI_AUTH_WPA_WPA2_PSK:
-            strcpy(auth_str, "wpa_wpa2");
-            break;
-        case WIFI_AUTH_WPA3_PSK:
-            strcpy(auth_str, "wpa3");
-            break;
-        case WIFI_AUTH_WPA2_WPA3_PSK:
-            strcpy(auth_str, "wpa2_wpa3");
-            break;
-        default:
-            strcpy(auth_str, "unknown");
-            break;
+            /* The records streamed so far have been replaced, e.g. when
+             * joining an all-channel scan: the client starts over */
+            chunk_writer_puts(&w, "event: reset\ndata: {}\n\n");
+            since = 0;
+            restart = true;
+            continue;
         }
+        restart = false;
+        since = changes;
 
-        snprintf(network_entry, sizeof(network_entry),
-                 "{\"ssid\":\"%s\",\"rssi\":%d,\"authmode\":\"%s\",\"channel\":%d}%s",
-                 ap_records[i].ssid,
-                 ap_records[i].rssi,
-                 auth_str,
-                 ap_records[i].primary,
-                 (i < ap_count - 1 && i < 19) ? "," : "");
+        if (channel && channel != reported_channel)
+        {
+            chunk_writer_printf(&w, "event: progress\ndata: {\"channel\":%d,\"last\":%d}\n\n", channel, last);
+            reported_channel = channel;
+        }
+        chunk_writer_flush(&w);
 
-        strcat(json_response, network_entry);
+        if (sent == 0)
+        {
+            if (!scanning)
+            {
+                break;
+            }
+            vTaskDelay(pdMS_TO_TICKS(SCAN_STREAM_POLL_MS));
+        }
     }
 
-    strcat(json_response, "]}");
-
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json_response, strlen(json_response));
+    chunk_writer_printf(&w, "event: done\ndata: {\"count\":%d}\n\n", count);
+    err = chunk_writer_finish(&w);
+    transfer_buf_release(buf);
+    ESP_LOGI(TAG_HTTP, "WiFi scan stream finished, %d networks", count);
+    return err;
+}
 
-    free(json_response);
-    ESP_LOGI(TAG_HTTP, "WiFi scan completed, found %d networks", ap_count);
-    return ESP_OK;
+/* The stream holds its connection for the whole scan, so it never runs in
+ * the server task */
+static esp_err_t wifi_scan_stream_async_handler(httpd_req_t *req)
+{
+    if (submit_async_req(req, wifi_scan_stream_handler) == ESP_OK)
+    {
+        return ESP_OK;
+    }
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_sendstr(req, "Server busy");
+    return ESP_FAIL;
 }
 
 /* HTTP POST handler for LED control */
@@ -591,103 +641,264 @@ static esp_err_t led_control_post_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
+    char out[JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+    json_object_begin(&j, NULL);
+    json_bool(&j, "success", true);
+    json_object_end(&j);
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, "{\"success\":true}");
-    return ESP_OK;
+    return chunk_writer_finish(&w);
 }
 
-/* HTTP POST handler for WiFi STA configuration */
-static esp_err_t wifi_config_post_handler(httpd_req_t *req)
+/* Largest JSON request body the API accepts */
+#define JSON_BODY_MAX 512
+
+/* Receives and parses a JSON request body. Sends the error response and
+ * returns NULL if that fails; the caller frees the result with
+ * cJSON_Delete() */
+static cJSON *recv_json_body(httpd_req_t *req)
 {
-    char buf[256];
-    int ret, remaining = req->content_len;
+    char buf[JSON_BODY_MAX];
+    int received = 0;
 
-    if (remaining >= sizeof(buf))
+    if (req->content_len >= sizeof(buf))
     {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content too long");
+        return NULL;
+    }
+    while (received < req->content_len)
+    {
+        int ret = httpd_req_recv(req, buf + received, req->content_len - received);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive data");
+            return NULL;
+        }
+        received += ret;
+    }
+
+    cJSON *json = cJSON_ParseWithLength(buf, received);
+    if (!json)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+    }
+    return json;
+}
+
+/* String member key of json that fits in size bytes, or NULL */
+static const char *json_get_str(const cJSON *json, const char *key, size_t size)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(json, key);
+    return cJSON_IsString(item) && strlen(item->valuestring) < size ? item->valuestring : NULL;
+}
+
+/* Priority member of json, CRED_DEFAULT_PRIORITY if absent */
+static int json_get_priority(const cJSON *json)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(json, "priority");
+    if (!cJSON_IsNumber(item))
+    {
+        return CRED_DEFAULT_PRIORITY;
+    }
+    return item->valueint < 0 ? 0 : item->valueint > UINT8_MAX ? UINT8_MAX : item->valueint;
+}
+
+/* HTTP POST handler for WiFi STA configuration. Saves the network, then
+ * connects to it straight away */
+static esp_err_t wifi_config_post_handler(httpd_req_t *req)
+{
+    cJSON *json = recv_json_body(req);
+    if (!json)
+    {
         return ESP_FAIL;
     }
 
-    ret = httpd_req_recv(req, buf, remaining);
-    if (ret <= 0)
+    const char *ssid = json_get_str(json, "ssid", CRED_SSID_SIZE);
+    const char *password = json_get_str(json, "password", CRED_PASSWORD_SIZE);
+    if (!ssid || !ssid[0] || !password)
     {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive data");
+        cJSON_Delete(json);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid WiFi configuration");
         return ESP_FAIL;
     }
-    buf[ret] = '\0';
 
-    // Parse JSON for SSID and password
-    char ssid[32] = {0};
-    char password[64] = {0};
+    const esp_err_t saved = cred_store_add(ssid, password, json_get_priority(json));
+    if (saved != ESP_OK)
+    {
+        ESP_LOGW(TAG_HTTP, "Network %s not saved (%s)", ssid, esp_err_to_name(saved));
+    }
 
-    // Simple JSON parsing - extract ssid and password
-    char *ssid_start = strstr(buf, "\"ssid\":\"");
-    char *pass_start = strstr(buf, "\"password\":\"");
+    /* The connect itself runs in the event loop */
+    ESP_LOGI(TAG_HTTP, "WiFi STA configured - SSID: %s", ssid);
+    const esp_err_t err = sta_manager_configure(ssid, password);
+    cJSON_Delete(json);
 
-    if (ssid_start && pass_start)
+    if (err != ESP_OK)
     {
-        ssid_start += 8; // Skip "ssid":"
-        char *ssid_end = strchr(ssid_start, '"');
-        if (ssid_end)
-        {
-            size_t ssid_len = ssid_end - ssid_start;
-            if (ssid_len < sizeof(ssid))
-            {
-                strncpy(ssid, ssid_start, ssid_len);
-                ssid[ssid_len] = '\0';
-            }
-        }
+        ESP_LOGE(TAG_HTTP, "WiFi connect not queued (%s)", esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to connect");
+        return ESP_FAIL;
+    }
 
-        pass_start += 12; // Skip "password":"
-        char *pass_end = strchr(pass_start, '"');
-        if (pass_end)
-        {
-            size_t pass_len = pass_end - pass_start;
-            if (pass_len < sizeof(password))
-            {
-                strncpy(password, pass_start, pass_len);
-                password[pass_len] = '\0';
-            }
-        }
+    char out[JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+    json_object_begin(&j, NULL);
+    json_bool(&j, "success", true);
+    json_bool(&j, "saved", saved == ESP_OK);
+    json_str(&j, "message", "Connecting to WiFi...");
+    json_object_end(&j);
+    httpd_resp_set_type(req, "application/json");
+    return chunk_writer_finish(&w);
+}
 
-        // Configure STA with new credentials
-        wifi_config_t wifi_sta_config = {
-            .sta = {
-                .ssid = "",
-                .password = "",
-                .scan_method = WIFI_ALL_CHANNEL_SCAN,
-                .failure_retry_cnt = EXAMPLE_ESP_MAXIMUM_RETRY,
-                .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-                .sae_pwe_h2e = WPA3_SAE_PWE_BOTH,
-            },
-        };
+/* HTTP GET handler listing the saved networks, without their passwords */
+static esp_err_t wifi_networks_get_handler(httpd_req_t *req)
+{
+    char out[2 * JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
 
-        strncpy((char *)wifi_sta_config.sta.ssid, ssid, sizeof(wifi_sta_config.sta.ssid) - 1);
-        strncpy((char *)wifi_sta_config.sta.password, password, sizeof(wifi_sta_config.sta.password) - 1);
+    /* Copied out, nothing is sent while holding the lock */
+    struct wifi_cred creds[CRED_MAX];
+    const int count = cred_store_copy(creds);
+
+    httpd_resp_set_type(req, "application/json");
+    json_object_begin(&j, NULL);
+    json_int(&j, "max", CRED_MAX);
+    json_array_begin(&j, "networks");
+    for (int i = 0; i < count; i++)
+    {
+        json_object_begin(&j, NULL);
+        json_str(&j, "ssid", creds[i].ssid);
+        json_int(&j, "priority", creds[i].priority);
+        json_bool(&j, "open", creds[i].password[0] == '\0');
+        json_object_end(&j);
+    }
+    json_array_end(&j);
+    json_object_end(&j);
+    memset(creds, 0, sizeof(creds));
+    return chunk_writer_finish(&w);
+}
 
-        ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_config));
-        ESP_ERROR_CHECK(esp_wifi_connect());
+/* Sends {"success":true} */
+static esp_err_t send_json_success(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, "{\"success\":true}");
+}
 
-        ESP_LOGI(TAG_HTTP, "WiFi STA configured - SSID: %s", ssid);
+/* HTTP POST handler adding a saved network, or updating the password and
+ * priority of one: {"ssid":..., "password":..., "priority":...} */
+static esp_err_t wifi_networks_post_handler(httpd_req_t *req)
+{
+    cJSON *json = recv_json_body(req);
+    if (!json)
+    {
+        return ESP_FAIL;
+    }
 
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_sendstr(req, "{\"success\":true,\"message\":\"Connecting to WiFi...\"}");
-        return ESP_OK;
+    const char *ssid = json_get_str(json, "ssid", CRED_SSID_SIZE);
+    const char *password = json_get_str(json, "password", CRED_PASSWORD_SIZE);
+    if (!ssid || !ssid[0] || !password)
+    {
+        cJSON_Delete(json);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid network");
+        return ESP_FAIL;
     }
 
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid WiFi configuration");
-    return ESP_FAIL;
+    const esp_err_t err = cred_store_add(ssid, password, json_get_priority(json));
+    ESP_LOGI(TAG_HTTP, "Saving network %s: %s", ssid, esp_err_to_name(err));
+    cJSON_Delete(json);
+    if (err == ESP_ERR_NO_MEM)
+    {
+        httpd_resp_set_status(req, "507 Insufficient Storage");
+        httpd_resp_sendstr(req, "Too many saved networks");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to save network");
+        return ESP_FAIL;
+    }
+    return send_json_success(req);
+}
+
+/* HTTP POST handler removing a saved network: {"ssid":...} */
+static esp_err_t wifi_networks_remove_post_handler(httpd_req_t *req)
+{
+    cJSON *json = recv_json_body(req);
+    if (!json)
+    {
+        return ESP_FAIL;
+    }
+
+    const char *ssid = json_get_str(json, "ssid", CRED_SSID_SIZE);
+    const esp_err_t err = ssid ? cred_store_remove(ssid) : ESP_ERR_INVALID_ARG;
+    ESP_LOGI(TAG_HTTP, "Removing network %s: %s", ssid ? ssid : "?", esp_err_to_name(err));
+    cJSON_Delete(json);
+    if (err == ESP_ERR_INVALID_ARG)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid network");
+        return ESP_FAIL;
+    }
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Network not saved");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to remove network");
+        return ESP_FAIL;
+    }
+    return send_json_success(req);
 }
 
 /* HTTP GET handler for LED status */
 static esp_err_t led_status_get_handler(httpd_req_t *req)
 {
-    char response[50];
-    snprintf(response, sizeof(response), "{\"state\":%s}", led_state ? "true" : "false");
+    char out[JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+    json_object_begin(&j, NULL);
+    json_bool(&j, "state", led_state);
+    json_object_end(&j);
 
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, response);
-    return ESP_OK;
+    return chunk_writer_finish(&w);
+}
+
+/* HTTP GET handler for static file cache statistics */
+static esp_err_t cache_stats_get_handler(httpd_req_t *req)
+{
+    /* Sized so nothing is sent while the cache locks are held */
+    char out[2 * JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+
+    json_object_begin(&j, NULL);
+
+    file_meta_write_stats(&j);
+    resp_cache_write_stats(&j);
+
+    xSemaphoreTake(scan_json_lock, portMAX_DELAY);
+    json_object_begin(&j, "scan");
+    json_int(&j, "hits", scan_json_stats.hits);
+    json_int(&j, "misses", scan_json_stats.misses);
+    json_int(&j, "oversize", scan_json_stats.oversize);
+    json_int(&j, "bytes", scan_json ? scan_json->size : 0);
+    json_object_end(&j);
+    xSemaphoreGive(scan_json_lock);
+
+    json_object_end(&j);
+    httpd_resp_set_type(req, "application/json");
+    return chunk_writer_finish(&w);
 }
 
 /* HTTP GET handler for WiFi connection status */
@@ -696,21 +907,52 @@ static esp_err_t wifi_status_get_handler(httpd_req_t *req)
     wifi_ap_record_t ap_info;
     esp_err_t ret = esp_wifi_sta_get_ap_info(&ap_info);
 
-    char response[200];
+    char out[2 * JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+    httpd_resp_set_type(req, "application/json");
+    json_object_begin(&j, NULL);
+    json_bool(&j, "connected", ret == ESP_OK);
     if (ret == ESP_OK)
     {
-        snprintf(response, sizeof(response),
-                 "{\"connected\":true,\"ssid\":\"%s\",\"rssi\":%d,\"channel\":%d}",
-                 ap_info.ssid, ap_info.rssi, ap_info.primary);
+        char bssid[18];
+
+        snprintf(bssid, sizeof(bssid), MACSTR, MAC2STR(ap_info.bssid));
+        json_str(&j, "ssid", (const char *)ap_info.ssid);
+        json_str(&j, "bssid", bssid);
+        json_int(&j, "rssi", ap_info.rssi);
+        json_int(&j, "channel", ap_info.primary);
     }
     else
     {
-        snprintf(response, sizeof(response), "{\"connected\":false,\"error\":\"Not connected\"}");
+        json_str(&j, "error", "Not connected");
     }
+    sta_manager_write_status(&j);
+    roam_write_status(&j);
+    json_object_end(&j);
+    return chunk_writer_finish(&w);
+}
+
+/* HTTP GET handler for the boot phase timestamps, in microseconds since
+ * boot, -1 for phases not reached yet */
+static esp_err_t boot_get_handler(httpd_req_t *req)
+{
+    char out[2 * JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
 
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, response);
-    return ESP_OK;
+    json_object_begin(&j, NULL);
+    json_int(&j, "now_us", esp_timer_get_time());
+    json_object_begin(&j, "phases_us");
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        const int64_t us = boot_phase_time(i);
+        json_int(&j, boot_phase_name(i), us ? us : -1);
+    }
+    json_object_end(&j);
+    json_object_end(&j);
+    return chunk_writer_finish(&w);
 }
 
 /* Start HTTP server */
@@ -732,7 +974,15 @@ static httpd_handle_t start_webserver(void)
         ESP_LOGE(TAG_HTTP, "Failed to allocate memory for server data");
         return NULL;
     }
-    strlcpy(server_data->base_path, "/spiffs", sizeof(server_data->base_path));
+    strlcpy(server_data->base_path, STORAGE_BASE_PATH, sizeof(server_data->base_path));
+
+    scan_json_lock = xSemaphoreCreateMutex();
+    if (init_file_cache() != ESP_OK || !scan_json_lock || init_dir_listing() != ESP_OK || init_transfer_buf_pool() != ESP_OK || start_async_workers() != ESP_OK ||
+        start_upload_writer() != ESP_OK)
+    {
+        ESP_LOGE(TAG_HTTP, "Failed to set up file transfer workers");
+        return NULL;
+    }
 
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
@@ -741,6 +991,7 @@ static httpd_handle_t start_webserver(void)
      * allow the same handler to respond to multiple different
      * target URIs which match the wildcard scheme */
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = 16;
 
     ESP_LOGI(TAG_HTTP, "Starting HTTP Server on port: '%d'", config.server_port);
     ESP_LOGI(TAG_HTTP, "Open browser to: http://192.168.4.1");
@@ -750,13 +1001,13 @@ static httpd_handle_t start_webserver(void)
         return NULL;
     }
 
-    /* URI handler for root page redirect */
-    httpd_uri_t root_redirect = {
+    /* URI handler for root page */
+    httpd_uri_t root = {
         .uri = "/",
         .method = HTTP_GET,
         .handler = root_get_handler,
-        .user_ctx = NULL};
-    httpd_register_uri_handler(server, &root_redirect);
+        .user_ctx = server_data};
+    httpd_register_uri_handler(server, &root);
 
     /* API handlers - register these before the wildcard handler */
     httpd_uri_t wifi_scan = {
@@ -766,6 +1017,13 @@ static httpd_handle_t start_webserver(void)
         .user_ctx = NULL};
     httpd_register_uri_handler(server, &wifi_scan);
 
+    httpd_uri_t wifi_scan_stream = {
+        .uri = "/api/wifi/scan/stream",
+        .method = HTTP_GET,
+        .handler = wifi_scan_stream_async_handler,
+        .user_ctx = NULL};
+    httpd_register_uri_handler(server, &wifi_scan_stream);
+
     httpd_uri_t led_control = {
         .uri = "/api/led/control",
         .method = HTTP_POST,
@@ -787,6 +1045,27 @@ static httpd_handle_t start_webserver(void)
         .user_ctx = NULL};
     httpd_register_uri_handler(server, &wifi_config);
 
+    httpd_uri_t wifi_networks = {
+        .uri = "/api/wifi/networks",
+        .method = HTTP_GET,
+        .handler = wifi_networks_get_handler,
+        .user_ctx = NULL};
+    httpd_register_uri_handler(server, &wifi_networks);
+
+    httpd_uri_t wifi_networks_add = {
+        .uri = "/api/wifi/networks",
+        .method = HTTP_POST,
+        .handler = wifi_networks_post_handler,
+        .user_ctx = NULL};
+    httpd_register_uri_handler(server, &wifi_networks_add);
+
+    httpd_uri_t wifi_networks_remove = {
+        .uri = "/api/wifi/networks/remove",
+        .method = HTTP_POST,
+        .handler = wifi_networks_remove_post_handler,
+        .user_ctx = NULL};
+    httpd_register_uri_handler(server, &wifi_networks_remove);
+
     httpd_uri_t wifi_status = {
         .uri = "/api/wifi/status",
         .method = HTTP_GET,
@@ -794,11 +1073,43 @@ static httpd_handle_t start_webserver(void)
         .user_ctx = NULL};
     httpd_register_uri_handler(server, &wifi_status);
 
+    httpd_uri_t boot = {
+        .uri = "/api/boot",
+        .method = HTTP_GET,
+        .handler = boot_get_handler,
+        .user_ctx = NULL};
+    httpd_register_uri_handler(server, &boot);
+
+    httpd_uri_t cache_stats = {
+        .uri = "/api/cache/stats",
+        .method = HTTP_GET,
+        .handler = cache_stats_get_handler,
+        .user_ctx = NULL};
+    httpd_register_uri_handler(server, &cache_stats);
+
+    /* URI handler for uploading files to storage */
+    httpd_uri_t file_upload = {
+        .uri = "/upload/*", // Match all URIs of type /upload/path/to/file
+        .method = HTTP_POST,
+        .handler = upload_post_async_handler,
+        .user_ctx = server_data // Pass server data as context
+    };
+    httpd_register_uri_handler(server, &file_upload);
+
+    /* URI handler for deleting files from storage */
+    httpd_uri_t file_delete = {
+        .uri = "/delete/*", // Match all URIs of type /delete/path/to/file
+        .method = HTTP_POST,
+        .handler = delete_post_handler,
+        .user_ctx = server_data // Pass server data as context
+    };
+    httpd_register_uri_handler(server, &file_delete);
+
     /* URI handler for getting uploaded files - register wildcard handler last */
     httpd_uri_t file_download = {
         .uri = "/*", // Match all URIs of type /path/to/file
         .method = HTTP_GET,
-        .handler = file_get_handler,
+        .handler = file_get_async_handler,
         .user_ctx = server_data // Pass server data as context
     };
     httpd_register_uri_handler(server, &file_download);
@@ -809,6 +1120,7 @@ static httpd_handle_t start_webserver(void)
 
 void app_main(void)
 {
+    boot_mark(BOOT_APP_MAIN);
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -820,19 +1132,66 @@ void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    boot_mark(BOOT_NVS_READY);
+
+#if STORAGE_BENCH_ENABLE
+    ESP_ERROR_CHECK(init_storage());
+    storage_bench_run();
+    return;
+#endif
+
+    /* The station's event handlers cannot run without these */
+    ESP_ERROR_CHECK(init_wifi_scan());
+    ESP_ERROR_CHECK(init_cred_store());
+    ESP_ERROR_CHECK(init_sta_manager());
+    /* Without its timer roaming stays off, the station still connects */
+    ret = init_roam();
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG_STA, "init_roam failed (%s), roaming is off", esp_err_to_name(ret));
+    }
+
+    /* Storage mounts in parallel with the HTTP server and WiFi bring-up
+     * below. The read-only web UI bundle is only mapped, so it is ready
+     * before the server starts */
+    const bool storage_async = xTaskCreate(storage_init_task, "storage_init", STORAGE_INIT_STACK_SIZE,
+                                           NULL, 5, NULL) == pdPASS;
+    init_webui_bundle();
+    server = start_webserver();
+    boot_mark(BOOT_HTTP_STARTED);
 
-    /* Initialize event group */
-    s_wifi_event_group = xEventGroupCreate();
+    /* Initialize GPIO for LED */
+    gpio_init_led();
 
     /* Register Event handler */
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                         ESP_EVENT_ANY_ID,
-                                                        &wifi_event_handler,
+                                                        &sta_manager_event_handler,
+                                                        NULL,
+                                                        NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
+                                                        ESP_EVENT_ANY_ID,
+                                                        &wifi_ap_event_handler,
                                                         NULL,
                                                         NULL));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
                                                         IP_EVENT_STA_GOT_IP,
-                                                        &wifi_event_handler,
+                                                        &sta_manager_event_handler,
+                                                        NULL,
+                                                        NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(STA_MGR_EVENT,
+                                                        ESP_EVENT_ANY_ID,
+                                                        &sta_manager_event_handler,
+                                                        NULL,
+                                                        NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(ROAM_EVENT,
+                                                        ESP_EVENT_ANY_ID,
+                                                        &sta_manager_event_handler,
+                                                        NULL,
+                                                        NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_SCAN_EVENT,
+                                                        ESP_EVENT_ANY_ID,
+                                                        &sta_manager_event_handler,
                                                         NULL,
                                                         NULL));
 
@@ -845,16 +1204,16 @@ void app_main(void)
     /* Initialize AP */
     ESP_LOGI(TAG_AP, "ESP_WIFI_MODE_AP");
     esp_netif_t *esp_netif_ap = wifi_init_softap();
+    ap_netif = esp_netif_ap;
 
     /* Initialize STA */
     ESP_LOGI(TAG_STA, "ESP_WIFI_MODE_STA");
-    esp_netif_t *wifi_init_sta_result = wifi_init_sta();
+    wifi_init_sta();
 
-    /* Start WiFi */
+    /* Start WiFi. The STA connects in the background, driven by events,
+     * and becomes the default netif once it has an IP */
     ESP_ERROR_CHECK(esp_wifi_start());
-
-    /* Start HTTP server immediately - don't wait for STA connection */
-    ESP_LOGI(TAG_HTTP, "Starting HTTP server in AP mode...");
+    boot_mark(BOOT_WIFI_STARTED);
 
     /* Enable napt on the AP netif for internet access through STA if connected */
     if (esp_netif_napt_enable(esp_netif_ap) != ESP_OK)
@@ -862,41 +1221,10 @@ void app_main(void)
         ESP_LOGE(TAG_STA, "NAPT not enabled on the netif: %p", esp_netif_ap);
     }
 
-    /*
-     * Try to connect STA in background - don't block on it
-     */
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           pdMS_TO_TICKS(10000)); // Wait 10 seconds max
-
-    /* Check STA connection status */
-    if (bits & WIFI_CONNECTED_BIT)
-    {
-        ESP_LOGI(TAG_STA, "connected to ap SSID:%s password:%s",
-                 EXAMPLE_ESP_WIFI_STA_SSID, EXAMPLE_ESP_WIFI_STA_PASSWD);
-        /* Set sta as the default interface when connected */
-        esp_netif_set_default_netif(wifi_init_sta_result);
-    }
-    else if (bits & WIFI_FAIL_BIT)
+    if (!storage_async)
     {
-        ESP_LOGI(TAG_STA, "Failed to connect to SSID:%s, password:%s",
-                 EXAMPLE_ESP_WIFI_STA_SSID, EXAMPLE_ESP_WIFI_STA_PASSWD);
+        storage_init();
     }
-    else
-    {
-        ESP_LOGI(TAG_STA, "STA connection attempt timed out - continuing in AP-only mode");
-    }
-
-    /* Initialize GPIO for LED */
-    gpio_init_led();
-
-    /* Initialize SPIFFS */
-    ESP_ERROR_CHECK(init_spiffs());
-
-    /* Start HTTP server */
-    server = start_webserver();
 
     ESP_LOGI(TAG_HTTP, "ESP32 SoftAP+STA with Web UI started!");
     ESP_LOGI(TAG_HTTP, "Connect to WiFi AP: %s", EXAMPLE_ESP_WIFI_AP_SSID);
@@ -0,0 +1,50 @@
+/* Generated by tools/gen_mime_table.py, do not edit */
+#pragma once
+
+#define MIME_HASH_SEED 0x812359f4U
+#define MIME_TABLE_BITS 6
+#define MIME_TABLE_SIZE (1 << MIME_TABLE_BITS)
+#define MIME_EXT_MAX 12
+
+static const struct
+{
+    char ext[MIME_EXT_MAX];
+    const char *type;
+} mime_table[MIME_TABLE_SIZE] = {
+    [1] = {"js", "application/javascript"},
+    [2] = {"mjs", "application/javascript"},
+    [4] = {"png", "image/png"},
+    [9] = {"map", "application/json"},
+    [10] = {"webm", "video/webm"},
+    [11] = {"webp", "image/webp"},
+    [12] = {"css", "text/css"},
+    [13] = {"csv", "text/csv"},
+    [15] = {"pdf", "application/pdf"},
+    [18] = {"json", "application/json"},
+    [19] = {"htm", "text/html"},
+    [20] = {"jpg", "image/jpeg"},
+    [24] = {"woff2", "font/woff2"},
+    [26] = {"svg", "image/svg+xml"},
+    [27] = {"zip", "application/zip"},
+    [28] = {"gif", "image/gif"},
+    [29] = {"wasm", "application/wasm"},
+    [30] = {"txt", "text/plain"},
+    [32] = {"xml", "application/xml"},
+    [34] = {"avif", "image/avif"},
+    [35] = {"ttf", "font/ttf"},
+    [36] = {"log", "text/plain"},
+    [37] = {"webmanifest", "application/manifest+json"},
+    [40] = {"woff", "font/woff"},
+    [43] = {"jpeg", "image/jpeg"},
+    [44] = {"pcap", "application/vnd.tcpdump.pcap"},
+    [46] = {"ico", "image/x-icon"},
+    [48] = {"wav", "audio/wav"},
+    [50] = {"mp3", "audio/mpeg"},
+    [51] = {"mp4", "video/mp4"},
+    [55] = {"bmp", "image/bmp"},
+    [56] = {"bin", "application/octet-stream"},
+    [58] = {"otf", "font/otf"},
+    [59] = {"html", "text/html"},
+    [61] = {"br", "application/octet-stream"},
+    [63] = {"gz", "application/gzip"},
+};
@@ -0,0 +1,342 @@
+/* Roaming between the access points of one network, see roam.h */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rrm.h"
+#include "esp_timer.h"
+#include "esp_wnm.h"
+#include "roam.h"
+#include "sta_manager.h"
+#include "wifi_scan.h"
+
+static const char *TAG_STA = "WiFi Sta";
+
+#define ROAM_RSSI_THRESHOLD -70
+#define ROAM_HYSTERESIS_DB 8
+#define ROAM_BTM_WAIT_MS 1500
+#define ROAM_NEIGHBOR_WAIT_MS 1000
+#define ROAM_INTERVAL_MS 30000
+
+enum roam_step
+{
+    ROAM_IDLE,
+    ROAM_BTM,          /* Waiting for the AP to move the station */
+    ROAM_NEIGHBORS,    /* Waiting for the neighbour report */
+    ROAM_SCAN,         /* Scanning the neighbour channels */
+    ROAM_CONNECTING,   /* Moving to another AP */
+};
+
+static struct
+{
+    enum roam_step step;
+    char ssid[33];
+    uint8_t bssid[6];       /* AP the check started on */
+    uint8_t channel;
+    int8_t rssi;
+    uint8_t best_bssid[6];  /* Strongest other AP of ssid the scan found */
+    uint8_t best_channel;
+    int8_t best_rssi;
+    int64_t start_us;       /* esp_timer time the check started */
+    int64_t move_us;        /* esp_timer time of the BTM query or of the connect to best */
+    int64_t due_us;         /* esp_timer time roam_timer expires */
+    uint32_t checks;
+    uint32_t roams;
+    uint32_t failures;
+    int64_t roam_ms;        /* Last roam, from move_us to associated, -1 if none */
+    int64_t roam_ip_ms;     /* and to IP */
+} roam = {.roam_ms = -1, .roam_ip_ms = -1};
+
+/* Ends the waits of a check, and re-arms the RSSI event afterwards */
+static esp_timer_handle_t roam_timer = NULL;
+
+/* A timer whose event does not fit in the loop's queue tries again this
+ * much later */
+#define ROAM_POST_RETRY_MS 10
+
+ESP_EVENT_DEFINE_BASE(ROAM_EVENT);
+
+static void roam_timer_start(uint32_t ms)
+{
+    roam.due_us = esp_timer_get_time() + ms * 1000LL;
+    esp_timer_stop(roam_timer);
+    esp_timer_start_once(roam_timer, ms * 1000ULL);
+}
+
+/* Ends the check in progress. The RSSI event is re-armed ROAM_INTERVAL_MS
+ * after the check started */
+static void roam_finish(void)
+{
+    const int64_t wait_ms = (roam.start_us - esp_timer_get_time()) / 1000 + ROAM_INTERVAL_MS;
+
+    roam.step = ROAM_IDLE;
+    roam_timer_start(wait_ms > 0 ? wait_ms : 1);
+}
+
+/* Notes record if it is another AP of the roaming network, or the current
+ * AP's new RSSI. Called by the scan module with its lock held */
+static void roam_scan_record_locked(const wifi_ap_record_t *record)
+{
+    if (strcmp((const char *)record->ssid, roam.ssid) != 0)
+    {
+        return;
+    }
+    if (memcmp(record->bssid, roam.bssid, sizeof(roam.bssid)) == 0)
+    {
+        roam.rssi = record->rssi;
+    }
+    else if (record->rssi > roam.best_rssi)
+    {
+        memcpy(roam.best_bssid, record->bssid, sizeof(roam.best_bssid));
+        roam.best_channel = record->primary;
+        roam.best_rssi = record->rssi;
+    }
+}
+
+void roam_scanned(void)
+{
+    wifi_config_t config;
+    esp_err_t err;
+
+    if (roam.step != ROAM_SCAN)
+    {
+        return;
+    }
+    if (roam.best_rssi < roam.rssi + ROAM_HYSTERESIS_DB || esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK)
+    {
+        ESP_LOGI(TAG_STA, "No better access point than " MACSTR " (RSSI %d)", MAC2STR(roam.bssid), roam.rssi);
+        roam_finish();
+        return;
+    }
+
+    config.sta.bssid_set = true;
+    memcpy(config.sta.bssid, roam.best_bssid, sizeof(config.sta.bssid));
+    config.sta.channel = roam.best_channel;
+    config.sta.scan_method = WIFI_FAST_SCAN;
+    ESP_LOGI(TAG_STA, "Roaming from " MACSTR " (RSSI %d) to " MACSTR " (RSSI %d) on channel %d",
+             MAC2STR(roam.bssid), roam.rssi, MAC2STR(roam.best_bssid), roam.best_rssi, roam.best_channel);
+
+    /* Leaving the current AP is not a disconnect to recover from */
+    roam.step = ROAM_CONNECTING;
+    roam.move_us = esp_timer_get_time();
+    sta_manager_roam_started();
+    err = esp_wifi_set_config(WIFI_IF_STA, &config);
+    if (err == ESP_OK)
+    {
+        err = esp_wifi_connect();
+        if (err != ESP_OK)
+        {
+            /* The new config already left the old AP */
+            ESP_LOGW(TAG_STA, "Roaming connect failed (%s)", esp_err_to_name(err));
+            roam.failures++;
+            roam_finish();
+            sta_manager_roam_failed(true);
+        }
+        return;
+    }
+    roam.failures++;
+    roam_finish();
+    sta_manager_roam_failed(false);
+}
+
+/* Arms WIFI_EVENT_STA_BSS_RSSI_LOW, which fires once per call */
+static void roam_arm(void)
+{
+#if ROAM_ENABLE
+    esp_wifi_set_rssi_threshold(ROAM_RSSI_THRESHOLD);
+#endif
+}
+
+/* Neighbour report element (802.11k): BSSID, BSSID info, operating
+ * class, channel and PHY type, then optional subelements */
+#define ROAM_EID_NEIGHBOR_REPORT 52
+#define ROAM_NEIGHBOR_MIN_LEN 13
+#define ROAM_NEIGHBOR_CHANNEL 11
+
+/* Channels of the APs in a neighbour report, as a bit mask */
+static uint16_t roam_neighbor_channels(const uint8_t *report, int len)
+{
+    uint16_t channels = 0;
+
+    /* The dialog token, then one element per neighbour */
+    for (int pos = 1; pos + 2 <= len && pos + 2 + report[pos + 1] <= len; pos += 2 + report[pos + 1])
+    {
+        const uint8_t *ie = &report[pos];
+        if (ie[0] != ROAM_EID_NEIGHBOR_REPORT || ie[1] < ROAM_NEIGHBOR_MIN_LEN)
+        {
+            continue;
+        }
+        const uint8_t channel = ie[2 + ROAM_NEIGHBOR_CHANNEL];
+        ESP_LOGI(TAG_STA, "Neighbour " MACSTR " on channel %d", MAC2STR(&ie[2]), channel);
+        channels |= channel < 16 ? 1U << channel : 0;
+    }
+    return channels;
+}
+
+/* Scans channels for a better AP. Without a neighbour report, the
+ * channels the network was seen on in the last scan are used, or the
+ * current one */
+static void roam_scan(uint16_t channels)
+{
+    struct scan_net net;
+    if (!channels && wifi_scan_find(roam.ssid, &net))
+    {
+        channels = net.channels;
+    }
+    if (!channels && roam.channel < 16)
+    {
+        channels = 1U << roam.channel;
+    }
+
+    roam.best_rssi = INT8_MIN;
+    roam.step = ROAM_SCAN;
+    esp_err_t err = wifi_scan_request_targeted(channels, roam_scan_record_locked);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG_STA, "Roaming scan not started (%s)", esp_err_to_name(err));
+        roam_finish();
+    }
+}
+
+/* Asks the AP for its neighbours, or scans right away if it can't say */
+static void roam_request_neighbors(void)
+{
+    if (esp_rrm_is_rrm_supported_connection() && esp_rrm_send_neighbor_report_request() == 0)
+    {
+        roam.step = ROAM_NEIGHBORS;
+        roam_timer_start(ROAM_NEIGHBOR_WAIT_MS);
+        return;
+    }
+    roam_scan(0);
+}
+
+void roam_rssi_low(int32_t rssi)
+{
+    wifi_ap_record_t ap_info;
+
+    /* No roam_timer if init_roam() failed */
+    if (!roam_timer || roam.step != ROAM_IDLE || !sta_manager_connected() ||
+        esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+    {
+        return;
+    }
+    strlcpy(roam.ssid, (const char *)ap_info.ssid, sizeof(roam.ssid));
+    memcpy(roam.bssid, ap_info.bssid, sizeof(roam.bssid));
+    roam.channel = ap_info.primary;
+    roam.rssi = ap_info.rssi;
+    roam.start_us = roam.move_us = esp_timer_get_time();
+    roam.checks++;
+    ESP_LOGI(TAG_STA, "RSSI %ld below %d, looking for a better access point", (long)rssi, ROAM_RSSI_THRESHOLD);
+
+    if (esp_wnm_is_btm_supported_connection() && esp_wnm_send_bss_transition_mgmt_query(REASON_RSSI, NULL, 0) == 0)
+    {
+        roam.step = ROAM_BTM;
+        roam_timer_start(ROAM_BTM_WAIT_MS);
+        return;
+    }
+    roam_request_neighbors();
+}
+
+void roam_neighbor_report(const wifi_event_neighbor_report_t *event)
+{
+    if (roam.step != ROAM_NEIGHBORS)
+    {
+        return;
+    }
+    esp_timer_stop(roam_timer);
+    roam_scan(roam_neighbor_channels(event->report, event->report_len));
+}
+
+static void roam_timer_cb(void *arg)
+{
+    if (esp_event_post(ROAM_EVENT, ROAM_EVENT_TIMER, NULL, 0, 0) != ESP_OK)
+    {
+        esp_timer_start_once(roam_timer, ROAM_POST_RETRY_MS * 1000ULL);
+    }
+}
+
+esp_err_t init_roam(void)
+{
+    const esp_timer_create_args_t roam_timer_args = {
+        .callback = roam_timer_cb,
+        .name = "roam",
+    };
+    return esp_timer_create(&roam_timer_args, &roam_timer);
+}
+
+void roam_timer_expired(void)
+{
+    if (esp_timer_get_time() < roam.due_us)
+    {
+        return;
+    }
+    switch (roam.step)
+    {
+    case ROAM_BTM:
+        /* The AP did not move the station */
+        roam_request_neighbors();
+        break;
+    case ROAM_NEIGHBORS:
+        ESP_LOGI(TAG_STA, "No neighbour report");
+        roam_scan(0);
+        break;
+    case ROAM_IDLE:
+        if (sta_manager_connected())
+        {
+            roam_arm();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void roam_associated(const uint8_t *bssid)
+{
+    if ((roam.step == ROAM_BTM || roam.step == ROAM_CONNECTING) && memcmp(bssid, roam.bssid, sizeof(roam.bssid)) != 0)
+    {
+        roam.roam_ms = (esp_timer_get_time() - roam.move_us) / 1000;
+        roam.step = ROAM_CONNECTING;
+    }
+}
+
+void roam_got_ip(void)
+{
+    if (roam.step == ROAM_CONNECTING)
+    {
+        roam.roams++;
+        roam.roam_ip_ms = (esp_timer_get_time() - roam.move_us) / 1000;
+        ESP_LOGI(TAG_STA, "Roamed in %lld ms, IP after %lld ms", (long long)roam.roam_ms, (long long)roam.roam_ip_ms);
+        roam_finish();
+    }
+    else if (roam.step == ROAM_IDLE && !esp_timer_is_active(roam_timer))
+    {
+        roam_arm();
+    }
+}
+
+void roam_disconnected(uint8_t reason)
+{
+    if (roam.step == ROAM_IDLE ||
+        ((roam.step == ROAM_BTM || roam.step == ROAM_CONNECTING) && reason == WIFI_REASON_ASSOC_LEAVE))
+    {
+        return;
+    }
+    if (roam.step == ROAM_CONNECTING)
+    {
+        ESP_LOGW(TAG_STA, "Roaming to " MACSTR " failed, reason %d", MAC2STR(roam.best_bssid), reason);
+        roam.failures++;
+        sta_config_unpin();
+    }
+    roam_finish();
+}
+
+void roam_write_status(struct json_writer *j)
+{
+    json_object_begin(j, "roam");
+    json_bool(j, "enabled", ROAM_ENABLE);
+    json_int(j, "checks", roam.checks);
+    json_int(j, "roams", roam.roams);
+    json_int(j, "failures", roam.failures);
+    json_int(j, "roam_ms", roam.roam_ms);
+    json_int(j, "roam_ip_ms", roam.roam_ip_ms);
+    json_object_end(j);
+}
@@ -0,0 +1,60 @@
+/* Roaming between the access points of one network. Once the RSSI of the
+ * current AP falls below ROAM_RSSI_THRESHOLD (WIFI_EVENT_STA_BSS_RSSI_LOW),
+ * an AP that supports BSS Transition Management (802.11v) is asked where
+ * to go, and the supplicant follows its answer. If it has none within
+ * ROAM_BTM_WAIT_MS, or does not support it, the station asks for a
+ * neighbour report (802.11k) and scans only the channels listed there, or
+ * the channels the network was last seen on if no report comes within
+ * ROAM_NEIGHBOR_WAIT_MS. A BSSID of the same network ROAM_HYSTERESIS_DB
+ * stronger than the current one is then joined directly. Checks start at
+ * most every ROAM_INTERVAL_MS. All of it runs in the default event loop */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "json_writer.h"
+
+#define ROAM_ENABLE 1
+
+/* Posted by the roaming timer, handled with roam_timer_expired() */
+ESP_EVENT_DECLARE_BASE(ROAM_EVENT);
+
+enum
+{
+    ROAM_EVENT_TIMER, /* roam_timer expired */
+};
+
+esp_err_t init_roam(void);
+
+/* ROAM_EVENT_TIMER. Ignored if roam_timer was started again while
+ * the event was queued */
+void roam_timer_expired(void);
+
+/* A scan finished: if it was the roaming scan, moves to the best AP it
+ * found if that is clearly stronger. Called in the event loop, without
+ * the scan lock held */
+void roam_scanned(void);
+
+/* WIFI_EVENT_STA_BSS_RSSI_LOW: starts a check for a better AP */
+void roam_rssi_low(int32_t rssi);
+
+/* WIFI_EVENT_STA_NEIGHBOR_REP */
+void roam_neighbor_report(const wifi_event_neighbor_report_t *event);
+
+/* WIFI_EVENT_STA_CONNECTED: times a move to another AP, ours or one the
+ * AP asked for */
+void roam_associated(const uint8_t *bssid);
+
+/* IP_EVENT_STA_GOT_IP: completes a move, or arms the RSSI event after a
+ * fresh connect */
+void roam_got_ip(void);
+
+/* WIFI_EVENT_STA_DISCONNECTED: ends the check, unless this is the old AP
+ * being left. If the move itself failed, the next connect is no longer
+ * pinned to the AP it tried */
+void roam_disconnected(uint8_t reason);
+
+/* Writes the roaming counters as the "roam" member of j */
+void roam_write_status(struct json_writer *j);
@@ -0,0 +1,950 @@
+/* Station connection manager, see sta_manager.h */
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_netif_net_stack.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "lwip/dhcp.h"
+#include "lwip/netif.h"
+#include "nvs.h"
+#include "boot.h"
+#include "cred_rank.h"
+#include "cred_store.h"
+#include "roam.h"
+#include "sta_manager.h"
+#include "wifi_scan.h"
+
+static const char *TAG_STA = "WiFi Sta";
+
+/* STA Configuration */
+#define EXAMPLE_ESP_WIFI_STA_SSID "your_wifi_ssid"
+#define EXAMPLE_ESP_WIFI_STA_PASSWD "your_wifi_password"
+#define EXAMPLE_ESP_MAXIMUM_RETRY 5
+
+/* The event group allows multiple bits for each event, but we only care about two events:
+ * - we are connected to the AP with an IP
+ * - we failed to connect after the maximum amount of retries */
+#define WIFI_CONNECTED_BIT BIT0
+#define WIFI_FAIL_BIT BIT1
+
+static int s_retry_num = 0;
+
+/* FreeRTOS event group to signal when we are connected/disconnected */
+static EventGroupHandle_t s_wifi_event_group;
+
+/* STA netif, made the default route once it has an IP */
+static esp_netif_t *sta_netif = NULL;
+
+/* Station reconnects. A failed or dropped connection is retried after a
+ * backoff that doubles from STA_BACKOFF_MIN_MS up to STA_BACKOFF_MAX_MS,
+ * jittered so that devices behind the same AP do not retry in step. The
+ * first STA_QUICK_RETRIES retries go straight back to the same access
+ * point, which is what an AP reboot needs; after that the station looks
+ * for any network again. Once STA_AUTH_FAIL_MAX authentication failures in
+ * a row suggest a wrong password, it waits the longest backoff. After
+ * EXAMPLE_ESP_MAXIMUM_RETRY failed retries WIFI_FAIL_BIT is set, but the
+ * retries go on */
+#define STA_BACKOFF_MIN_MS 500
+#define STA_BACKOFF_MAX_MS 60000
+#define STA_QUICK_RETRIES 3
+#define STA_AUTH_FAIL_MAX 2
+
+enum sta_state
+{
+    STA_STATE_IDLE,
+    STA_STATE_CONNECTING,
+    STA_STATE_CONNECTED,
+    STA_STATE_BACKOFF,
+};
+
+static struct
+{
+    enum sta_state state;
+    uint8_t last_reason;    /* Of the last disconnect, wifi_err_reason_t */
+    uint8_t auth_failures;  /* In a row */
+    bool rescan;            /* The next retry looks for any network */
+    uint32_t backoff_ms;    /* Before the next retry after this one */
+    int64_t retry_us;       /* esp_timer time of the pending retry */
+    uint32_t drops;         /* Connections lost after getting an IP */
+    bool link_hinted;       /* The connect in progress uses sta_link */
+} sta_sm = {.backoff_ms = STA_BACKOFF_MIN_MS};
+
+static esp_timer_handle_t sta_retry_timer = NULL;
+
+/* Held while the event loop changes the manager's state, so that
+ * sta_manager_write_status() on an HTTP task copies a consistent one */
+static SemaphoreHandle_t sta_state_lock = NULL;
+
+/* sta_sm and sta_select are only changed from the default event loop, in
+ * sta_manager_event_handler(). Timer callbacks and HTTP handlers post one
+ * of these events instead. A timer whose event does not fit in the
+ * loop's queue tries again STA_MGR_POST_RETRY_MS later, an HTTP handler
+ * waits up to STA_MGR_POST_TIMEOUT_MS for room */
+#define STA_MGR_POST_RETRY_MS 10
+#define STA_MGR_POST_TIMEOUT_MS 100
+
+ESP_EVENT_DEFINE_BASE(STA_MGR_EVENT);
+
+enum
+{
+    STA_MGR_EVENT_RETRY,      /* The backoff of sta_retry_timer is over */
+    STA_MGR_EVENT_CONFIG,     /* New credentials, struct sta_mgr_config */
+};
+
+static const char *sta_state_str(enum sta_state state)
+{
+    switch (state)
+    {
+    case STA_STATE_CONNECTING:
+        return "connecting";
+    case STA_STATE_CONNECTED:
+        return "connected";
+    case STA_STATE_BACKOFF:
+        return "backoff";
+    default:
+        return "idle";
+    }
+}
+
+/* Reasons that point at the credentials rather than the radio */
+static bool sta_reason_is_auth(uint8_t reason)
+{
+    switch (reason)
+    {
+    case WIFI_REASON_AUTH_FAIL:
+    case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+    case WIFI_REASON_HANDSHAKE_TIMEOUT:
+    case WIFI_REASON_802_1X_AUTH_FAILED:
+    case WIFI_REASON_MIC_FAILURE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Schedules the next connect attempt. rescan skips the quick retries to
+ * the same access point */
+static void sta_schedule_retry(bool rescan)
+{
+    const bool auth = sta_reason_is_auth(sta_sm.last_reason);
+
+    sta_sm.auth_failures = auth ? sta_sm.auth_failures + 1 : 0;
+    if (sta_sm.auth_failures >= STA_AUTH_FAIL_MAX)
+    {
+        sta_sm.backoff_ms = STA_BACKOFF_MAX_MS;
+    }
+    /* Half the backoff plus up to the other half at random */
+    const uint32_t delay_ms = sta_sm.backoff_ms / 2 + esp_random() % (sta_sm.backoff_ms / 2 + 1);
+    sta_sm.backoff_ms = sta_sm.backoff_ms * 2 < STA_BACKOFF_MAX_MS ? sta_sm.backoff_ms * 2 : STA_BACKOFF_MAX_MS;
+    s_retry_num++;
+    sta_sm.rescan = rescan || s_retry_num > STA_QUICK_RETRIES;
+    if (s_retry_num >= EXAMPLE_ESP_MAXIMUM_RETRY || sta_sm.auth_failures >= STA_AUTH_FAIL_MAX)
+    {
+        xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+    }
+
+    sta_sm.state = STA_STATE_BACKOFF;
+    sta_sm.retry_us = esp_timer_get_time() + delay_ms * 1000LL;
+    esp_timer_stop(sta_retry_timer);
+    esp_timer_start_once(sta_retry_timer, delay_ms * 1000ULL);
+    ESP_LOGI(TAG_STA, "Retry %d in %lu ms%s, last reason %d", s_retry_num, (unsigned long)delay_ms,
+             sta_sm.rescan ? " with a scan" : "", sta_sm.last_reason);
+}
+
+/* Forgets the retry state, for a fresh connect or after one succeeded */
+static void sta_reset_retries(void)
+{
+    esp_timer_stop(sta_retry_timer);
+    s_retry_num = 0;
+    sta_sm.auth_failures = 0;
+    sta_sm.rescan = false;
+    sta_sm.backoff_ms = STA_BACKOFF_MIN_MS;
+    xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
+}
+
+bool sta_manager_connected(void)
+{
+    return sta_sm.state == STA_STATE_CONNECTED;
+}
+
+void sta_manager_roam_started(void)
+{
+    sta_sm.state = STA_STATE_CONNECTING;
+}
+
+void sta_manager_roam_failed(bool left)
+{
+    if (left)
+    {
+        sta_schedule_retry(true);
+    }
+    else if (sta_sm.state == STA_STATE_CONNECTING)
+    {
+        /* Still on the old AP */
+        sta_sm.state = STA_STATE_CONNECTED;
+    }
+}
+
+/* Fills in the station config every connect starts from, so the call
+ * sites cannot drift apart: ssid and password, every channel, and the
+ * neighbour reports and BSS transitions roaming needs (see ROAM_ENABLE).
+ * Callers pin a BSSID on top of it */
+static void sta_build_config(wifi_config_t *config, const char *ssid, const char *password)
+{
+    memset(config, 0, sizeof(*config));
+    strncpy((char *)config->sta.ssid, ssid, sizeof(config->sta.ssid));
+    strncpy((char *)config->sta.password, password, sizeof(config->sta.password));
+    config->sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    config->sta.failure_retry_cnt = EXAMPLE_ESP_MAXIMUM_RETRY;
+    /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
+     * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
+     * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
+     * WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK standards.
+     */
+    config->sta.threshold.authmode = password[0] ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+    config->sta.sae_pwe_h2e = WPA3_SAE_PWE_BOTH;
+    config->sta.rm_enabled = ROAM_ENABLE;
+    config->sta.btm_enabled = ROAM_ENABLE;
+}
+
+static struct
+{
+    struct sta_candidate list[CRED_MAX];
+    uint8_t count;
+    uint8_t next;         /* Candidate to try next */
+    bool scanning;        /* Waiting for the selection scan */
+    bool connecting;      /* A candidate is being tried */
+    int64_t start_us;     /* esp_timer time the selection started */
+    int64_t connect_ms;   /* Start of the last selection to its IP, -1 if none */
+    uint8_t attempts;     /* Candidates that selection tried */
+} sta_select = {.connect_ms = -1};
+
+/* Tries the next candidate, or schedules a new selection once none is
+ * left */
+static void sta_select_next(void)
+{
+    while (sta_select.next < sta_select.count)
+    {
+        const struct sta_candidate *c = &sta_select.list[sta_select.next++];
+        wifi_config_t config;
+        sta_build_config(&config, "", "");
+        config.sta.bssid_set = true;
+        memcpy(config.sta.bssid, c->bssid, sizeof(config.sta.bssid));
+        config.sta.channel = c->channel;
+        config.sta.scan_method = WIFI_FAST_SCAN;
+
+        /* Removed since the scan */
+        if (!cred_store_config(&config, c->ssid))
+        {
+            continue;
+        }
+        ESP_LOGI(TAG_STA, "Trying %s (%d of %d, priority %d, RSSI %d)", c->ssid, sta_select.next,
+                 sta_select.count, c->priority, c->rssi);
+        if (esp_wifi_set_config(WIFI_IF_STA, &config) == ESP_OK && esp_wifi_connect() == ESP_OK)
+        {
+            sta_select.connecting = true;
+            sta_select.attempts++;
+            return;
+        }
+    }
+
+    sta_select.connecting = false;
+    ESP_LOGW(TAG_STA, "No saved network could be joined, %d in range", sta_select.count);
+    sta_schedule_retry(true);
+}
+
+/* A scan finished: if the selection was waiting for it, ranks the saved
+ * networks it found and tries the best. Called without the scan lock held */
+static void sta_select_scanned(void)
+{
+    if (!sta_select.scanning)
+    {
+        return;
+    }
+    sta_select.scanning = false;
+
+    struct wifi_cred creds[CRED_MAX];
+    const int count = cred_store_copy(creds);
+    for (int i = 0; i < count; i++)
+    {
+        strlcpy(sta_select.list[i].ssid, creds[i].ssid, sizeof(sta_select.list[0].ssid));
+        sta_select.list[i].priority = creds[i].priority;
+    }
+    memset(creds, 0, sizeof(creds));
+
+    int found = 0;
+    struct scan_net net;
+    for (int i = 0; i < count; i++)
+    {
+        if (wifi_scan_find(sta_select.list[i].ssid, &net))
+        {
+            struct sta_candidate *c = &sta_select.list[found++];
+            *c = sta_select.list[i];
+            memcpy(c->bssid, net.bssid, sizeof(c->bssid));
+            c->channel = net.channel;
+            c->rssi = net.rssi;
+        }
+    }
+
+    cred_rank(sta_select.list, found);
+    sta_select.count = found;
+
+    ESP_LOGI(TAG_STA, "Selection scan took %lld ms, %d of %d saved networks in range",
+             (long long)((esp_timer_get_time() - sta_select.start_us) / 1000), found, count);
+    sta_select_next();
+}
+
+/* Starts a connect through the saved networks with a scan for them */
+static void sta_select_start(void)
+{
+    sta_select.count = 0;
+    sta_select.next = 0;
+    sta_select.attempts = 0;
+    sta_select.connecting = false;
+    sta_select.scanning = true;
+    sta_select.start_us = esp_timer_get_time();
+    sta_sm.state = STA_STATE_CONNECTING;
+
+    esp_err_t err = wifi_scan_request(false);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG_STA, "Selection scan not started (%s)", esp_err_to_name(err));
+        sta_select.scanning = false;
+        sta_schedule_retry(true);
+    }
+}
+
+void sta_config_unpin(void)
+{
+    wifi_config_t config;
+
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK && config.sta.bssid_set)
+    {
+        config.sta.bssid_set = false;
+        config.sta.channel = 0;
+        config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        esp_wifi_set_config(WIFI_IF_STA, &config);
+    }
+}
+
+/* Starts a connect: back to the last access point, or, for a fresh start
+ * or a rescan, through the saved networks if there are any */
+static void sta_connect(bool rescan)
+{
+    if (rescan && cred_store_count() > 0)
+    {
+        sta_select_start();
+        return;
+    }
+    if (rescan)
+    {
+        sta_config_unpin();
+    }
+    sta_sm.state = STA_STATE_CONNECTING;
+    if (esp_wifi_connect() != ESP_OK)
+    {
+        sta_schedule_retry(true);
+    }
+}
+
+static void sta_retry_timer_cb(void *arg)
+{
+    if (esp_event_post(STA_MGR_EVENT, STA_MGR_EVENT_RETRY, NULL, 0, 0) != ESP_OK)
+    {
+        esp_timer_start_once(sta_retry_timer, STA_MGR_POST_RETRY_MS * 1000ULL);
+    }
+}
+
+esp_err_t init_sta_manager(void)
+{
+    const esp_timer_create_args_t retry_timer_args = {
+        .callback = sta_retry_timer_cb,
+        .name = "sta_retry",
+    };
+
+    s_wifi_event_group = xEventGroupCreate();
+    sta_state_lock = xSemaphoreCreateMutex();
+    if (s_wifi_event_group == NULL || sta_state_lock == NULL ||
+        esp_timer_create(&retry_timer_args, &sta_retry_timer) != ESP_OK)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* STA_MGR_EVENT_RETRY. The timer may have been stopped and started again
+ * while its event was queued, so the retry must also be due */
+static void sta_retry(void)
+{
+    if (sta_sm.state == STA_STATE_BACKOFF && esp_timer_get_time() >= sta_sm.retry_us)
+    {
+        sta_connect(sta_sm.rescan);
+    }
+}
+
+/* The access point the station last got an IP from, kept in NVS so that
+ * the next connect goes straight to its BSSID on its channel instead of
+ * scanning every channel first. If that connect fails, the entry is
+ * dropped and the station falls back to a full scan. STA_LINK_CACHE_ENABLE
+ * 0 always does the full scan, e.g. to compare boot-to-IP times */
+#define STA_LINK_CACHE_ENABLE 1
+#define STA_LINK_NVS_NAMESPACE "wifi_link"
+#define STA_LINK_NVS_KEY "last"
+#define STA_LINK_VERSION 1
+
+struct sta_link
+{
+    uint8_t version;      /* STA_LINK_VERSION, 0 if there is no entry */
+    uint8_t channel;
+    uint8_t authmode;     /* wifi_auth_mode_t */
+    uint8_t bssid[6];
+    char ssid[33];
+};
+
+static struct sta_link sta_link;
+/* The threshold sta_link replaced, see sta_sm.link_hinted */
+static wifi_auth_mode_t sta_link_threshold;
+/* Boot to first IP, -1 until then, and whether that connect used sta_link */
+static int64_t sta_boot_to_ip_ms = -1;
+static bool sta_boot_hinted = false;
+
+static void sta_link_load(void)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof(sta_link);
+
+    memset(&sta_link, 0, sizeof(sta_link));
+    if (nvs_open(STA_LINK_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_get_blob(nvs, STA_LINK_NVS_KEY, &sta_link, &size) != ESP_OK ||
+        size != sizeof(sta_link) || sta_link.version != STA_LINK_VERSION)
+    {
+        memset(&sta_link, 0, sizeof(sta_link));
+    }
+    nvs_close(nvs);
+}
+
+/* Stores the access point the station is associated with, unless NVS
+ * already holds it */
+static void sta_link_save(void)
+{
+    wifi_ap_record_t ap_info;
+    struct sta_link link = {.version = STA_LINK_VERSION};
+    nvs_handle_t nvs;
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+    {
+        return;
+    }
+    link.channel = ap_info.primary;
+    link.authmode = ap_info.authmode;
+    memcpy(link.bssid, ap_info.bssid, sizeof(link.bssid));
+    strlcpy(link.ssid, (const char *)ap_info.ssid, sizeof(link.ssid));
+    if (memcmp(&link, &sta_link, sizeof(link)) == 0)
+    {
+        return;
+    }
+
+    if (nvs_open(STA_LINK_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_set_blob(nvs, STA_LINK_NVS_KEY, &link, sizeof(link)) == ESP_OK && nvs_commit(nvs) == ESP_OK)
+    {
+        sta_link = link;
+        ESP_LOGI(TAG_STA, "Cached " MACSTR " on channel %d", MAC2STR(link.bssid), link.channel);
+    }
+    nvs_close(nvs);
+}
+
+static void sta_link_forget(void)
+{
+    nvs_handle_t nvs;
+
+    memset(&sta_link, 0, sizeof(sta_link));
+    if (nvs_open(STA_LINK_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK)
+    {
+        nvs_erase_key(nvs, STA_LINK_NVS_KEY);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+/* Points config at the cached access point if it belongs to the SSID
+ * being configured: only its channel is scanned, and the auth threshold
+ * is raised to what it used, so a downgraded impostor is not joined */
+static void sta_link_apply(wifi_config_t *config)
+{
+#if STA_LINK_CACHE_ENABLE
+    if (sta_link.version != STA_LINK_VERSION ||
+        strncmp(sta_link.ssid, (const char *)config->sta.ssid, sizeof(config->sta.ssid)) != 0)
+    {
+        return;
+    }
+
+    config->sta.bssid_set = true;
+    memcpy(config->sta.bssid, sta_link.bssid, sizeof(config->sta.bssid));
+    config->sta.channel = sta_link.channel;
+    config->sta.scan_method = WIFI_FAST_SCAN;
+    sta_link_threshold = config->sta.threshold.authmode;
+    if (sta_link.authmode > config->sta.threshold.authmode)
+    {
+        config->sta.threshold.authmode = sta_link.authmode;
+    }
+    sta_sm.link_hinted = true;
+    ESP_LOGI(TAG_STA, "Connecting to cached " MACSTR " on channel %d", MAC2STR(sta_link.bssid), sta_link.channel);
+#endif
+}
+
+/* The connect to the cached access point failed: forget it and connect
+ * again with a full scan, or through the saved networks */
+static void sta_link_fallback(void)
+{
+    wifi_config_t config;
+
+    sta_sm.link_hinted = false;
+    sta_link_forget();
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK)
+    {
+        sta_connect(true);
+        return;
+    }
+    config.sta.bssid_set = false;
+    config.sta.channel = 0;
+    config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    config.sta.threshold.authmode = sta_link_threshold;
+    ESP_LOGW(TAG_STA, "Cached access point failed, falling back to a full scan");
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+    sta_connect(true);
+}
+
+/* STA addressing. With DHCP, lwIP keeps the last address in NVS
+ * (CONFIG_LWIP_DHCP_RESTORE_LAST_IP) and every DHCP start is an
+ * INIT-REBOOT: a single REQUEST for that address, bound on the ACK
+ * without the ARP probe a fresh offer gets. A NAK, e.g. on another
+ * network, drops lwIP back to the full DISCOVER exchange.
+ * STA_STATIC_IP_ENABLE 1 skips DHCP and uses the address below.
+ *
+ * The last lease is also kept here, with its gateway, DNS and lease
+ * time, to tell whether a reconnect got its address back */
+#define STA_STATIC_IP_ENABLE 0
+#define STA_STATIC_IP "192.168.1.50"
+#define STA_STATIC_NETMASK "255.255.255.0"
+#define STA_STATIC_GATEWAY "192.168.1.1"
+#define STA_STATIC_DNS "192.168.1.1"
+#define STA_LEASE_NVS_NAMESPACE "wifi_lease"
+#define STA_LEASE_NVS_KEY "last"
+#define STA_LEASE_VERSION 1
+
+struct sta_lease
+{
+    uint8_t version;      /* STA_LEASE_VERSION, 0 if there is no entry */
+    uint8_t is_static;
+    char ssid[33];
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+    esp_ip4_addr_t dns[2];
+    uint32_t lease_s;     /* 0 for a static address */
+};
+
+static struct sta_lease sta_lease;
+/* When sta_lease was obtained, 0 if it is from an earlier boot */
+static int64_t sta_lease_us = 0;
+/* Association of the connect in progress, and the time from the last
+ * association to its IP, -1 until then */
+static int64_t sta_assoc_us = 0;
+static int64_t sta_assoc_to_ip_ms = -1;
+/* The last IP was the cached lease's address */
+static bool sta_lease_reused = false;
+
+static void sta_lease_load(void)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof(sta_lease);
+
+    memset(&sta_lease, 0, sizeof(sta_lease));
+    if (nvs_open(STA_LEASE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_get_blob(nvs, STA_LEASE_NVS_KEY, &sta_lease, &size) != ESP_OK ||
+        size != sizeof(sta_lease) || sta_lease.version != STA_LEASE_VERSION)
+    {
+        memset(&sta_lease, 0, sizeof(sta_lease));
+    }
+    nvs_close(nvs);
+}
+
+/* Reads the lease time of the bound DHCP lease into *ctx, in seconds. The
+ * DHCP client state belongs to the TCP/IP thread, so this runs there
+ * through esp_netif_tcpip_exec(). lwIP exposes no accessor for the lease
+ * time, offered_t0_lease is read from struct dhcp of the public
+ * lwip/dhcp.h */
+static esp_err_t sta_lease_time_tcpip(void *ctx)
+{
+    struct netif *netif = esp_netif_get_netif_impl(sta_netif);
+    struct dhcp *dhcp = netif ? netif_dhcp_data(netif) : NULL;
+
+    *(uint32_t *)ctx = dhcp ? dhcp->offered_t0_lease : 0;
+    return ESP_OK;
+}
+
+static uint32_t sta_lease_time(void)
+{
+    uint32_t lease_s = 0;
+
+    if (esp_netif_tcpip_exec(sta_lease_time_tcpip, &lease_s) != ESP_OK)
+    {
+        return 0;
+    }
+    return lease_s;
+}
+
+/* Stores the lease behind ip_info, unless NVS already holds it. A renewed
+ * lease only moves the expiry, which is tracked from sta_lease_us */
+static void sta_lease_save(const esp_netif_ip_info_t *ip_info)
+{
+    wifi_ap_record_t ap_info;
+    esp_netif_dns_info_t dns;
+    struct sta_lease lease;
+    nvs_handle_t nvs;
+
+    /* Zeroes the padding too, the entries are compared with memcmp */
+    memset(&lease, 0, sizeof(lease));
+    lease.version = STA_LEASE_VERSION;
+    lease.is_static = STA_STATIC_IP_ENABLE;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
+    {
+        strlcpy(lease.ssid, (const char *)ap_info.ssid, sizeof(lease.ssid));
+    }
+    lease.ip = ip_info->ip;
+    lease.netmask = ip_info->netmask;
+    lease.gw = ip_info->gw;
+    for (int i = 0; i < 2; i++)
+    {
+        if (esp_netif_get_dns_info(sta_netif, i ? ESP_NETIF_DNS_BACKUP : ESP_NETIF_DNS_MAIN, &dns) == ESP_OK &&
+            dns.ip.type == ESP_IPADDR_TYPE_V4)
+        {
+            lease.dns[i] = dns.ip.u_addr.ip4;
+        }
+    }
+    lease.lease_s = STA_STATIC_IP_ENABLE ? 0 : sta_lease_time();
+    sta_lease_us = esp_timer_get_time();
+
+    sta_lease_reused = sta_lease.version && sta_lease.ip.addr == lease.ip.addr && strcmp(sta_lease.ssid, lease.ssid) == 0;
+    if (memcmp(&lease, &sta_lease, sizeof(lease)) == 0)
+    {
+        return;
+    }
+
+    if (nvs_open(STA_LEASE_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_set_blob(nvs, STA_LEASE_NVS_KEY, &lease, sizeof(lease)) == ESP_OK && nvs_commit(nvs) == ESP_OK)
+    {
+        sta_lease = lease;
+        ESP_LOGI(TAG_STA, "Cached lease " IPSTR " for %lu s", IP2STR(&ip_info->ip), (unsigned long)lease.lease_s);
+    }
+    nvs_close(nvs);
+}
+
+/* Replaces the DHCP client the default handlers just started with the
+ * static address, which posts GOT_IP right away. If the address can't
+ * be set the DHCP client is started again */
+static void sta_static_ip_apply(void)
+{
+#if STA_STATIC_IP_ENABLE
+    esp_netif_ip_info_t ip_info = {0};
+    esp_netif_dns_info_t dns = {.ip.type = ESP_IPADDR_TYPE_V4};
+    esp_err_t err = esp_netif_dhcpc_stop(sta_netif);
+
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED)
+    {
+        ESP_LOGE(TAG_STA, "Failed to stop the DHCP client: %s", esp_err_to_name(err));
+        return;
+    }
+    if (esp_netif_str_to_ip4(STA_STATIC_IP, &ip_info.ip) != ESP_OK ||
+        esp_netif_str_to_ip4(STA_STATIC_NETMASK, &ip_info.netmask) != ESP_OK ||
+        esp_netif_str_to_ip4(STA_STATIC_GATEWAY, &ip_info.gw) != ESP_OK ||
+        esp_netif_set_ip_info(sta_netif, &ip_info) != ESP_OK)
+    {
+        ESP_LOGE(TAG_STA, "Failed to set the static IP, falling back to DHCP");
+        esp_netif_dhcpc_start(sta_netif);
+        return;
+    }
+    if (esp_netif_str_to_ip4(STA_STATIC_DNS, &dns.ip.u_addr.ip4) == ESP_OK)
+    {
+        esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+#endif
+}
+
+struct sta_mgr_config
+{
+    char ssid[CRED_SSID_SIZE];
+    char password[CRED_PASSWORD_SIZE];
+};
+
+/* STA_MGR_EVENT_CONFIG: connects with the credentials posted to
+ * /api/wifi/config */
+static void sta_configure(const struct sta_mgr_config *cfg)
+{
+    wifi_config_t wifi_sta_config;
+    sta_build_config(&wifi_sta_config, cfg->ssid, cfg->password);
+
+    /* New credentials, a failure must not be taken for a stale cache or
+     * move a selection on, and earlier failures no longer count */
+    sta_sm.link_hinted = false;
+    sta_select.connecting = false;
+    sta_reset_retries();
+    sta_sm.state = STA_STATE_CONNECTING;
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_config);
+    if (err == ESP_OK)
+    {
+        err = esp_wifi_connect();
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG_STA, "WiFi connect to %s failed (%s)", cfg->ssid, esp_err_to_name(err));
+        sta_schedule_retry(false);
+    }
+}
+
+esp_err_t sta_manager_configure(const char *ssid, const char *password)
+{
+    struct sta_mgr_config cfg;
+
+    strlcpy(cfg.ssid, ssid, sizeof(cfg.ssid));
+    strlcpy(cfg.password, password, sizeof(cfg.password));
+    const esp_err_t err = esp_event_post(STA_MGR_EVENT, STA_MGR_EVENT_CONFIG, &cfg, sizeof(cfg),
+                                         pdMS_TO_TICKS(STA_MGR_POST_TIMEOUT_MS));
+    memset(cfg.password, 0, sizeof(cfg.password));
+    return err;
+}
+
+/* A scan finished, the selection and roaming may be waiting for it */
+static void sta_scanned(void)
+{
+    sta_select_scanned();
+    roam_scanned();
+}
+
+static void sta_manager_handle(esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (event_base == STA_MGR_EVENT && event_id == STA_MGR_EVENT_RETRY)
+    {
+        sta_retry();
+    }
+    else if (event_base == STA_MGR_EVENT && event_id == STA_MGR_EVENT_CONFIG)
+    {
+        sta_configure((const struct sta_mgr_config *)event_data);
+    }
+    else if (event_base == WIFI_SCAN_EVENT && event_id == WIFI_SCAN_EVENT_SLICE)
+    {
+        if (wifi_scan_slice())
+        {
+            sta_scanned();
+        }
+    }
+    else if (event_base == ROAM_EVENT && event_id == ROAM_EVENT_TIMER)
+    {
+        roam_timer_expired();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        boot_mark(BOOT_STA_CONNECTED);
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        sta_assoc_us = esp_timer_get_time();
+        sta_static_ip_apply();
+        if (sta_sm.state == STA_STATE_BACKOFF)
+        {
+            /* The supplicant reconnected on its own, e.g. for a BSS
+             * transition the AP asked for */
+            esp_timer_stop(sta_retry_timer);
+            sta_sm.state = STA_STATE_CONNECTING;
+        }
+        roam_associated(event->bssid);
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_BSS_RSSI_LOW)
+    {
+        roam_rssi_low(((wifi_event_bss_rssi_low_t *)event_data)->rssi);
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_NEIGHBOR_REP)
+    {
+        roam_neighbor_report((wifi_event_neighbor_report_t *)event_data);
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
+    {
+        if (wifi_scan_done((wifi_event_sta_scan_done_t *)event_data))
+        {
+            sta_scanned();
+        }
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        /* The cached access point goes first, it needs no scan */
+        sta_connect(!sta_sm.link_hinted);
+        ESP_LOGI(TAG_STA, "Station started");
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        ESP_LOGI(TAG_STA, "Disconnected, reason %d, state %s", event->reason, sta_state_str(sta_sm.state));
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        sta_sm.last_reason = event->reason;
+        roam_disconnected(event->reason);
+
+        if (sta_sm.state == STA_STATE_CONNECTED)
+        {
+            /* Lost an AP we had: start over quickly, e.g. it rebooted */
+            sta_sm.drops++;
+            sta_reset_retries();
+        }
+        if (sta_sm.state == STA_STATE_BACKOFF || sta_select.scanning ||
+            (sta_sm.state == STA_STATE_CONNECTING && event->reason == WIFI_REASON_ASSOC_LEAVE))
+        {
+            /* A retry is already pending, the selection scan connects once
+             * it is done, or this is the old connection being left for a
+             * new one */
+        }
+        else if (sta_sm.link_hinted)
+        {
+            sta_link_fallback();
+        }
+        else if (sta_select.connecting)
+        {
+            sta_select_next();
+        }
+        else
+        {
+            sta_schedule_retry(false);
+        }
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        boot_mark(BOOT_STA_GOT_IP);
+        /* Route through the upstream network */
+        esp_netif_set_default_netif(sta_netif);
+        sta_assoc_to_ip_ms = (esp_timer_get_time() - sta_assoc_us) / 1000;
+        sta_lease_save(&event->ip_info);
+        ESP_LOGI(TAG_STA, "Got IP %lld ms after association (%s)", (long long)sta_assoc_to_ip_ms,
+                 STA_STATIC_IP_ENABLE ? "static" : sta_lease_reused ? "lease reused" : "new lease");
+        if (sta_boot_to_ip_ms < 0)
+        {
+            sta_boot_to_ip_ms = esp_timer_get_time() / 1000;
+            sta_boot_hinted = sta_sm.link_hinted;
+        }
+        ESP_LOGI(TAG_STA, "Got IP:" IPSTR ", %lld ms after boot (%s)", IP2STR(&event->ip_info.ip),
+                 (long long)sta_boot_to_ip_ms, sta_boot_hinted ? "cached access point" : "full scan");
+        if (sta_select.connecting)
+        {
+            sta_select.connecting = false;
+            sta_select.connect_ms = (esp_timer_get_time() - sta_select.start_us) / 1000;
+            ESP_LOGI(TAG_STA, "Saved network joined %lld ms after the selection started, attempt %d",
+                     (long long)sta_select.connect_ms, sta_select.attempts);
+        }
+        sta_sm.link_hinted = false;
+        sta_link_save();
+        sta_reset_retries();
+        sta_sm.state = STA_STATE_CONNECTED;
+        roam_got_ip();
+        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+    }
+}
+
+void sta_manager_event_handler(void *arg, esp_event_base_t event_base,
+                               int32_t event_id, void *event_data)
+{
+    xSemaphoreTake(sta_state_lock, portMAX_DELAY);
+    sta_manager_handle(event_base, event_id, event_data);
+    xSemaphoreGive(sta_state_lock);
+}
+
+esp_netif_t *wifi_init_sta(void)
+{
+    sta_netif = esp_netif_create_default_wifi_sta();
+
+    wifi_config_t wifi_sta_config;
+    sta_build_config(&wifi_sta_config, EXAMPLE_ESP_WIFI_STA_SSID, EXAMPLE_ESP_WIFI_STA_PASSWD);
+
+    /* The cached access point may be one of the saved networks */
+    cred_store_load();
+    sta_link_load();
+    sta_lease_load();
+    if (sta_link.version)
+    {
+        cred_store_config(&wifi_sta_config, sta_link.ssid);
+    }
+    sta_link_apply(&wifi_sta_config);
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_config));
+
+    ESP_LOGI(TAG_STA, "wifi_init_sta finished.");
+
+    return sta_netif;
+}
+
+void sta_manager_write_status(struct json_writer *j)
+{
+    /* Copied under the lock, formatted without it */
+    xSemaphoreTake(sta_state_lock, portMAX_DELAY);
+    const int64_t boot_to_ip_ms = sta_boot_to_ip_ms;
+    const bool boot_hinted = sta_boot_hinted;
+    const int64_t assoc_to_ip_ms = sta_assoc_to_ip_ms;
+    const struct sta_lease lease = sta_lease;
+    const bool lease_reused = sta_lease_reused;
+    const int64_t lease_us = sta_lease_us;
+    const int64_t select_ms = sta_select.connect_ms;
+    const uint8_t select_attempts = sta_select.attempts;
+    const enum sta_state state = sta_sm.state;
+    const uint8_t last_reason = sta_sm.last_reason;
+    const uint8_t auth_failures = sta_sm.auth_failures;
+    const uint32_t drops = sta_sm.drops;
+    const int64_t retry_us = sta_sm.retry_us;
+    const int retries = s_retry_num;
+    xSemaphoreGive(sta_state_lock);
+
+    json_int(j, "boot_to_ip_ms", boot_to_ip_ms);
+    json_bool(j, "cached_link", boot_hinted);
+    json_int(j, "assoc_to_ip_ms", assoc_to_ip_ms);
+    if (lease.version)
+    {
+        char ip[16];
+
+        json_object_begin(j, "lease");
+        json_str(j, "source", lease.is_static ? "static" : "dhcp");
+        json_bool(j, "reused", lease_reused);
+        json_str(j, "ip", esp_ip4addr_ntoa(&lease.ip, ip, sizeof(ip)));
+        json_str(j, "gateway", esp_ip4addr_ntoa(&lease.gw, ip, sizeof(ip)));
+        json_str(j, "dns", esp_ip4addr_ntoa(&lease.dns[0], ip, sizeof(ip)));
+        json_int(j, "lease_s", lease.lease_s);
+        if (lease_us && lease.lease_s)
+        {
+            const int64_t left_s = lease.lease_s - (esp_timer_get_time() - lease_us) / 1000000;
+            json_int(j, "expires_in_s", left_s > 0 ? left_s : 0);
+        }
+        json_object_end(j);
+    }
+    json_int(j, "select_ms", select_ms);
+    json_int(j, "select_attempts", select_attempts);
+    json_str(j, "state", sta_state_str(state));
+    json_int(j, "retries", retries);
+    json_int(j, "last_reason", last_reason);
+    json_int(j, "auth_failures", auth_failures);
+    json_int(j, "drops", drops);
+    if (state == STA_STATE_BACKOFF)
+    {
+        const int64_t wait_us = retry_us - esp_timer_get_time();
+        json_int(j, "retry_in_ms", wait_us > 0 ? wait_us / 1000 : 0);
+    }
+}
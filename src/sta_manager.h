@@ -0,0 +1,52 @@
+/* Station connection manager: the reconnect state machine, the saved
+ * network selection, the cached access point and lease. Its state is only
+ * changed from the default event loop */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "json_writer.h"
+
+/* Internal events of the manager, handled with sta_manager_event_handler() */
+ESP_EVENT_DECLARE_BASE(STA_MGR_EVENT);
+
+esp_err_t init_sta_manager(void);
+
+/* Creates the STA netif and configures the station: pinned to the cached
+ * access point, with its saved credentials, if there is one, else with the
+ * example credentials. Without a cached access point, saved networks are
+ * picked by a selection scan once the station starts. No saved network is
+ * configured here. Call after esp_wifi_init() */
+esp_netif_t *wifi_init_sta(void);
+
+/* Handler for WIFI_EVENT, IP_EVENT_STA_GOT_IP, STA_MGR_EVENT, ROAM_EVENT
+ * and WIFI_SCAN_EVENT, registered in the default event loop */
+void sta_manager_event_handler(void *arg, esp_event_base_t event_base,
+                               int32_t event_id, void *event_data);
+
+/* Connects with new credentials. The connect runs in the event loop, this
+ * only queues it, and fails if the loop's queue stays full */
+esp_err_t sta_manager_configure(const char *ssid, const char *password);
+
+/* Writes the connection timings, the lease and the reconnect state as
+ * members of the open object j */
+void sta_manager_write_status(struct json_writer *j);
+
+/* The station has an IP and no connect is in progress */
+bool sta_manager_connected(void);
+
+/* A roaming move to another access point starts. Leaving the current one
+ * is not a disconnect to recover from */
+void sta_manager_roam_started(void);
+
+/* The move did not start. If left is set the station already left the old
+ * access point and reconnects like after a drop, otherwise it is still
+ * connected there */
+void sta_manager_roam_failed(bool left);
+
+/* Drops the BSSID and channel a connect was pinned to, so the next one
+ * scans every channel */
+void sta_config_unpin(void);
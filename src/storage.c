@@ -0,0 +1,292 @@
+/* Storage filesystem, see storage.h */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "boot.h"
+#include "storage.h"
+#if CONFIG_STORAGE_FS_LITTLEFS
+#include "esp_littlefs.h"
+#else
+#include "esp_spiffs.h"
+#endif
+
+static const char *TAG_HTTP = "HTTP Server";
+
+#define STORAGE_PARTITION "storage"
+#define STORAGE_MAX_FILES 8 /* One per async worker plus the httpd task, with room for listings */
+
+/* Filesystem backend, chosen in menuconfig (see src/Kconfig.projbuild) */
+#if CONFIG_STORAGE_FS_LITTLEFS
+#define STORAGE_FS_NAME "LittleFS"
+#else
+#define STORAGE_FS_NAME "SPIFFS"
+#endif
+
+esp_err_t storage_info(size_t *total, size_t *used)
+{
+#if CONFIG_STORAGE_FS_LITTLEFS
+    return esp_littlefs_info(STORAGE_PARTITION, total, used);
+#else
+    return esp_spiffs_info(STORAGE_PARTITION, total, used);
+#endif
+}
+
+esp_err_t init_storage(void)
+{
+    ESP_LOGI(TAG_HTTP, "Initializing %s", STORAGE_FS_NAME);
+
+#if CONFIG_STORAGE_FS_LITTLEFS
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = STORAGE_BASE_PATH,
+        .partition_label = STORAGE_PARTITION,
+        .format_if_mount_failed = true};
+
+    esp_err_t ret = esp_vfs_littlefs_register(&conf);
+#else
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = STORAGE_BASE_PATH,
+        .partition_label = STORAGE_PARTITION,
+        .max_files = STORAGE_MAX_FILES,
+        .format_if_mount_failed = true};
+
+    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+#endif
+
+    if (ret != ESP_OK)
+    {
+        if (ret == ESP_FAIL)
+        {
+            ESP_LOGE(TAG_HTTP, "Failed to mount or format filesystem");
+        }
+        else if (ret == ESP_ERR_NOT_FOUND)
+        {
+            ESP_LOGE(TAG_HTTP, "Failed to find '%s' partition", STORAGE_PARTITION);
+        }
+        else
+        {
+            ESP_LOGE(TAG_HTTP, "Failed to initialize %s (%s)", STORAGE_FS_NAME, esp_err_to_name(ret));
+        }
+        return ret;
+    }
+
+    size_t total = 0, used = 0;
+    ret = storage_info(&total, &used);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG_HTTP, "Failed to get %s partition information (%s)", STORAGE_FS_NAME, esp_err_to_name(ret));
+    }
+    else
+    {
+        ESP_LOGI(TAG_HTTP, "%s partition size: total: %d, used: %d", STORAGE_FS_NAME, total, used);
+    }
+
+    return ESP_OK;
+}
+
+#define STORAGE_BENCH_PREFIX STORAGE_BASE_PATH "/bench-"
+#define STORAGE_BENCH_SMALL_FILES 16
+#define STORAGE_BENCH_SMALL_SIZE 1024
+#define STORAGE_BENCH_OPEN_ROUNDS 8
+#define STORAGE_BENCH_READ_SIZE (32 * 1024)
+#define STORAGE_BENCH_FILL_SIZE (16 * 1024)
+#define STORAGE_BENCH_FILL_PCT 90
+#define STORAGE_BENCH_BUF_SIZE 4096
+
+#if STORAGE_BENCH_ENABLE
+static void storage_bench_path(char *path, size_t size, const char *kind, int i)
+{
+    snprintf(path, size, STORAGE_BENCH_PREFIX "%s-%d", kind, i);
+}
+
+static bool storage_bench_write(const char *path, const char *buf, size_t size)
+{
+    FILE *fd = fopen(path, "w");
+    if (!fd)
+    {
+        return false;
+    }
+    size_t written = 0;
+    while (written < size)
+    {
+        size_t len = size - written < STORAGE_BENCH_BUF_SIZE ? size - written : STORAGE_BENCH_BUF_SIZE;
+        if (fwrite(buf, 1, len, fd) != len)
+        {
+            break;
+        }
+        written += len;
+    }
+    return fclose(fd) == 0 && written == size;
+}
+
+static void storage_bench_remove(const char *kind, int count)
+{
+    char path[64];
+    for (int i = 0; i < count; i++)
+    {
+        storage_bench_path(path, sizeof(path), kind, i);
+        unlink(path);
+    }
+}
+
+/* One round of measurements at the current fill level */
+static void storage_bench_pass(const char *label, char *buf)
+{
+    char path[64];
+    int64_t start;
+
+    /* Small-file writes, the pattern of uploads and settings files */
+    start = esp_timer_get_time();
+    int written = 0;
+    for (int i = 0; i < STORAGE_BENCH_SMALL_FILES; i++)
+    {
+        storage_bench_path(path, sizeof(path), "small", i);
+        written += storage_bench_write(path, buf, STORAGE_BENCH_SMALL_SIZE);
+    }
+    const int64_t write_us = esp_timer_get_time() - start;
+
+    /* Open latency, the fixed cost of every static file request */
+    start = esp_timer_get_time();
+    int opens = 0;
+    for (int r = 0; r < STORAGE_BENCH_OPEN_ROUNDS; r++)
+    {
+        for (int i = 0; i < written; i++)
+        {
+            storage_bench_path(path, sizeof(path), "small", i);
+            FILE *fd = fopen(path, "r");
+            if (fd)
+            {
+                fclose(fd);
+                opens++;
+            }
+        }
+    }
+    const int64_t open_us = esp_timer_get_time() - start;
+
+    /* Sequential read of one larger file */
+    size_t read = 0;
+    int64_t read_us = 0;
+    storage_bench_path(path, sizeof(path), "read", 0);
+    if (storage_bench_write(path, buf, STORAGE_BENCH_READ_SIZE))
+    {
+        start = esp_timer_get_time();
+        FILE *fd = fopen(path, "r");
+        if (fd)
+        {
+            size_t len;
+            while ((len = fread(buf, 1, STORAGE_BENCH_BUF_SIZE, fd)) > 0)
+            {
+                read += len;
+            }
+            fclose(fd);
+        }
+        read_us = esp_timer_get_time() - start;
+    }
+
+    ESP_LOGI(TAG_HTTP, "bench %s [%s]: open %lld us, read %lld KB/s, small write %d/%d files %lld KB/s (%lld ms/file)",
+             STORAGE_FS_NAME, label,
+             opens ? open_us / opens : -1LL,
+             read_us ? (long long)read * 1000000 / 1024 / read_us : -1LL,
+             written, STORAGE_BENCH_SMALL_FILES,
+             write_us ? (long long)written * STORAGE_BENCH_SMALL_SIZE * 1000000 / 1024 / write_us : -1LL,
+             written ? write_us / written / 1000 : -1LL);
+
+    storage_bench_remove("small", STORAGE_BENCH_SMALL_FILES);
+    storage_bench_remove("read", 1);
+}
+
+void storage_bench_run(void)
+{
+    char *buf = malloc(STORAGE_BENCH_BUF_SIZE);
+    if (!buf)
+    {
+        return;
+    }
+    for (int i = 0; i < STORAGE_BENCH_BUF_SIZE; i++)
+    {
+        buf[i] = (char)(i * 31 + 7);
+    }
+
+    storage_bench_pass("as mounted", buf);
+
+    /* Fill so that the partition is at STORAGE_BENCH_FILL_PCT while the
+     * next pass has its files written */
+    size_t total = 0, used = 0;
+    storage_info(&total, &used);
+    const size_t footprint = STORAGE_BENCH_SMALL_FILES * STORAGE_BENCH_SMALL_SIZE + STORAGE_BENCH_READ_SIZE;
+    const size_t target = total / 100 * STORAGE_BENCH_FILL_PCT;
+    int fill = 0;
+    char path[64];
+    while (used + footprint < target)
+    {
+        storage_bench_path(path, sizeof(path), "fill", fill);
+        if (!storage_bench_write(path, buf, STORAGE_BENCH_FILL_SIZE))
+        {
+            break;
+        }
+        fill++;
+        storage_info(&total, &used);
+    }
+    ESP_LOGI(TAG_HTTP, "bench %s: filled to %u of %u bytes", STORAGE_FS_NAME, (unsigned)used, (unsigned)total);
+
+    char label[16];
+    snprintf(label, sizeof(label), "%d%% full", STORAGE_BENCH_FILL_PCT);
+    storage_bench_pass(label, buf);
+
+    storage_bench_remove("fill", fill + 1);
+    free(buf);
+}
+#endif
+
+static atomic_uint generation = 0;
+
+unsigned int storage_generation(void)
+{
+    return atomic_load(&generation);
+}
+
+void storage_changed(void)
+{
+    atomic_fetch_add(&generation, 1);
+}
+
+/* Set once the storage mount has been attempted. The HTTP server starts
+ * before that, requests that need storage get a 503 until then */
+static atomic_bool storage_ready = false;
+
+bool storage_check_ready(httpd_req_t *req)
+{
+    if (atomic_load(&storage_ready))
+    {
+        return true;
+    }
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    httpd_resp_sendstr(req, "Storage is not mounted yet");
+    return false;
+}
+
+/* Metadata looked up before the mount is dropped through storage_changed() */
+void storage_init(void)
+{
+    esp_err_t err = init_storage();
+    if (err != ESP_OK)
+    {
+        /* The UI bundle and the API still work */
+        ESP_LOGE(TAG_HTTP, "Storage not mounted (%s)", esp_err_to_name(err));
+    }
+    storage_changed();
+    atomic_store(&storage_ready, true);
+    boot_mark(BOOT_STORAGE_READY);
+}
+
+void storage_init_task(void *arg)
+{
+    storage_init();
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,48 @@
+/* Filesystem on the "storage" partition, mounted at STORAGE_BASE_PATH,
+ * and the state the file server keeps about it */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define STORAGE_BASE_PATH "/storage"
+
+/* Max length a file path can have on storage */
+#define FILE_PATH_MAX 256
+
+#define STORAGE_INIT_STACK_SIZE 4096
+
+/* Total and used bytes of the storage filesystem */
+esp_err_t storage_info(size_t *total, size_t *used);
+
+/* Mount the storage partition at STORAGE_BASE_PATH */
+esp_err_t init_storage(void);
+
+/* Mounts the storage filesystem, which on first boot includes formatting
+ * it, and marks storage ready whether or not that worked */
+void storage_init(void);
+
+/* Runs storage_init() while WiFi and the HTTP server come up */
+void storage_init_task(void *arg);
+
+/* Bumped by every write the firmware makes to storage. Directory snapshots
+ * and cached metadata taken under an older generation are stale */
+unsigned int storage_generation(void);
+void storage_changed(void);
+
+/* Answers 503 and returns false while storage is still being mounted */
+bool storage_check_ready(httpd_req_t *req);
+
+/* Storage benchmark, for comparing the two backends. Built by the
+ * storage_bench env in platformio.ini, which sets STORAGE_BENCH_ENABLE:
+ * that firmware mounts the storage partition, runs the benchmark, logs the
+ * results and does nothing else, so it needs no WiFi and also runs under
+ * QEMU. It writes its own files and removes them again, but fills the
+ * partition to STORAGE_BENCH_FILL_PCT on the way */
+#ifndef STORAGE_BENCH_ENABLE
+#define STORAGE_BENCH_ENABLE 0
+#endif
+
+void storage_bench_run(void);
@@ -0,0 +1,319 @@
+/* File uploads and deletes, see upload.h */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "file_cache.h"
+#include "file_server.h"
+#include "json_writer.h"
+#include "storage.h"
+#include "upload.h"
+
+static const char *TAG_HTTP = "HTTP Server";
+
+/* Uploads stream the request body to a temp file through two buffers: one
+ * is filled from the socket while the writer task flushes the other */
+#define UPLOAD_BUF_SIZE 8192
+#define UPLOAD_TMP_SUFFIX "~"
+#define UPLOAD_OLD_SUFFIX "~~"
+
+/* Share of the partition kept free: SPIFFS needs spare pages to garbage
+ * collect into, and writes start failing well before used reaches total */
+#define UPLOAD_FREE_RESERVE_PCT 10
+#define UPLOAD_WRITER_STACK_SIZE 4096
+#define UPLOAD_WRITER_PRIORITY 5
+
+/* A filled buffer handed to the writer task */
+struct upload_block
+{
+    FILE *fd;
+    char *buf;
+    size_t len;
+    atomic_bool *failed; /* Set by the writer task if fwrite() falls short */
+};
+
+/* Filled buffers to the writer task, and written buffers back */
+static QueueHandle_t upload_write_queue = NULL;
+static QueueHandle_t upload_free_queue = NULL;
+
+/* One upload at a time, they share the writer task */
+static SemaphoreHandle_t upload_lock = NULL;
+
+static void upload_writer_task(void *arg)
+{
+    struct upload_block block;
+
+    while (true)
+    {
+        if (xQueueReceive(upload_write_queue, &block, portMAX_DELAY) == pdTRUE)
+        {
+            if (!atomic_load(block.failed) && fwrite(block.buf, 1, block.len, block.fd) != block.len)
+            {
+                atomic_store(block.failed, true);
+            }
+            xQueueSend(upload_free_queue, &block.buf, portMAX_DELAY);
+        }
+    }
+}
+
+esp_err_t start_upload_writer(void)
+{
+    upload_write_queue = xQueueCreate(1, sizeof(struct upload_block));
+    upload_free_queue = xQueueCreate(2, sizeof(char *));
+    upload_lock = xSemaphoreCreateMutex();
+    if (!upload_write_queue || !upload_free_queue || !upload_lock)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(upload_writer_task, "upload_writer", UPLOAD_WRITER_STACK_SIZE, NULL,
+                    UPLOAD_WRITER_PRIORITY, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* Receives the whole request body into fd through the writer task.
+ * Returns the number of bytes received, or -1 if the connection failed */
+static int upload_receive(httpd_req_t *req, FILE *fd, char *bufs, atomic_bool *failed)
+{
+    char *buf;
+    int remaining = req->content_len;
+    int received_total = 0;
+
+    buf = bufs;
+    xQueueSend(upload_free_queue, &buf, 0);
+    buf = bufs + UPLOAD_BUF_SIZE;
+    xQueueSend(upload_free_queue, &buf, 0);
+
+    while (remaining > 0 && !atomic_load(failed))
+    {
+        xQueueReceive(upload_free_queue, &buf, portMAX_DELAY);
+
+        size_t len = 0;
+        while (len < UPLOAD_BUF_SIZE && remaining > 0)
+        {
+            const size_t want = UPLOAD_BUF_SIZE - len < remaining ? UPLOAD_BUF_SIZE - len : remaining;
+            int received = httpd_req_recv(req, buf + len, want);
+            if (received == HTTPD_SOCK_ERR_TIMEOUT)
+            {
+                /* Retry if timeout occurred */
+                continue;
+            }
+            if (received <= 0)
+            {
+                received_total = -1;
+                break;
+            }
+            len += received;
+            remaining -= received;
+        }
+
+        if (received_total < 0)
+        {
+            xQueueSend(upload_free_queue, &buf, 0);
+            break;
+        }
+        struct upload_block block = {.fd = fd, .buf = buf, .len = len, .failed = failed};
+        xQueueSend(upload_write_queue, &block, portMAX_DELAY);
+        received_total += len;
+    }
+
+    /* Wait for the writer task to hand both buffers back */
+    xQueueReceive(upload_free_queue, &buf, portMAX_DELAY);
+    xQueueReceive(upload_free_queue, &buf, portMAX_DELAY);
+    return received_total;
+}
+
+esp_err_t upload_post_handler(httpd_req_t *req)
+{
+    char filepath[FILE_PATH_MAX];
+    char tmppath[FILE_PATH_MAX];
+    char oldpath[FILE_PATH_MAX];
+
+    if (!storage_check_ready(req))
+    {
+        return ESP_FAIL;
+    }
+
+    /* Skip leading "/upload" from URI to get filename */
+    const char *filename = get_path_from_uri(filepath, ((struct file_server_data *)req->user_ctx)->base_path,
+                                             req->uri + sizeof("/upload") - 1, sizeof(filepath));
+    if (!filename || snprintf(tmppath, sizeof(tmppath), "%s" UPLOAD_TMP_SUFFIX, filepath) >= sizeof(tmppath) ||
+        snprintf(oldpath, sizeof(oldpath), "%s" UPLOAD_OLD_SUFFIX, filepath) >= sizeof(oldpath))
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
+    }
+
+    /* Filename cannot have a trailing '/' */
+    if (filename[0] == '\0' || filename[strlen(filename) - 1] == '/')
+    {
+        ESP_LOGE(TAG_HTTP, "Invalid filename : %s", filename);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid filename");
+        return ESP_FAIL;
+    }
+
+    /* The temp file exists alongside the old version until the rename */
+    size_t total = 0, used = 0;
+    const esp_err_t info = storage_info(&total, &used);
+    const size_t reserve = total / 100 * UPLOAD_FREE_RESERVE_PCT;
+    const size_t available = info == ESP_OK && total - used > reserve ? total - used - reserve : 0;
+    if (req->content_len > available)
+    {
+        ESP_LOGE(TAG_HTTP, "Upload of %u bytes exceeds free space (%u bytes)", (unsigned)req->content_len,
+                 (unsigned)available);
+        httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE, "Not enough free space");
+        return ESP_FAIL;
+    }
+
+    if (xSemaphoreTake(upload_lock, 0) != pdTRUE)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_sendstr(req, "Another upload is in progress");
+        return ESP_FAIL;
+    }
+
+    char *bufs = malloc(2 * UPLOAD_BUF_SIZE);
+    FILE *fd = bufs ? fopen(tmppath, "w") : NULL;
+    if (!fd)
+    {
+        ESP_LOGE(TAG_HTTP, "Failed to create file : %s", tmppath);
+        free(bufs);
+        xSemaphoreGive(upload_lock);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG_HTTP, "Receiving file : %s (%u bytes)", filename, (unsigned)req->content_len);
+    const int64_t start = esp_timer_get_time();
+    atomic_bool write_failed = false;
+    const int received = upload_receive(req, fd, bufs, &write_failed);
+    const bool failed = fclose(fd) != 0 || atomic_load(&write_failed);
+    free(bufs);
+
+    if (received < 0 || failed)
+    {
+        unlink(tmppath);
+        xSemaphoreGive(upload_lock);
+        storage_changed();
+        ESP_LOGE(TAG_HTTP, "Upload of %s failed (%s)", filename, received < 0 ? "connection" : "write");
+        if (received < 0)
+        {
+            /* Connection is gone, nothing to respond to */
+            return ESP_FAIL;
+        }
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        return ESP_FAIL;
+    }
+
+    /* SPIFFS rename() does not replace an existing file, so the old version
+     * is moved aside and only removed once the new one is in place. Not
+     * atomic: a reset in between leaves it at <path>~~ */
+    bool moved_aside = false;
+    bool stored = rename(tmppath, filepath) == 0;
+    if (!stored)
+    {
+        unlink(oldpath); /* Left over from an interrupted replace */
+        moved_aside = rename(filepath, oldpath) == 0;
+        stored = moved_aside && rename(tmppath, filepath) == 0;
+        if (moved_aside && !stored)
+        {
+            rename(oldpath, filepath);
+        }
+    }
+    if (!stored)
+    {
+        unlink(tmppath);
+        xSemaphoreGive(upload_lock);
+        storage_changed();
+        ESP_LOGE(TAG_HTTP, "Failed to rename %s to %s", tmppath, filepath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store file");
+        return ESP_FAIL;
+    }
+    if (moved_aside)
+    {
+        unlink(oldpath);
+    }
+    const long long elapsed_us = esp_timer_get_time() - start;
+    xSemaphoreGive(upload_lock);
+    storage_changed();
+    resp_cache_invalidate();
+
+    const unsigned int kbps = elapsed_us ? (unsigned int)((long long)received * 1000000 / 1024 / elapsed_us) : 0;
+    ESP_LOGI(TAG_HTTP, "File reception complete : %s, %d bytes in %lld ms (%u KB/s)", filename, received,
+             elapsed_us / 1000, kbps);
+
+    char out[JSON_SMALL_BUF_SIZE];
+    struct chunk_writer w = {.req = req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+    json_object_begin(&j, NULL);
+    json_int(&j, "size", received);
+    json_int(&j, "ms", elapsed_us / 1000);
+    json_int(&j, "kbps", kbps);
+    json_object_end(&j);
+    httpd_resp_set_type(req, "application/json");
+    return chunk_writer_finish(&w);
+}
+
+esp_err_t delete_post_handler(httpd_req_t *req)
+{
+    char filepath[FILE_PATH_MAX];
+    char location[FILE_PATH_MAX];
+
+    if (!storage_check_ready(req))
+    {
+        return ESP_FAIL;
+    }
+
+    /* Skip leading "/delete" from URI to get filename */
+    const char *filename = get_path_from_uri(filepath, ((struct file_server_data *)req->user_ctx)->base_path,
+                                             req->uri + sizeof("/delete") - 1, sizeof(filepath));
+    if (!filename)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
+    }
+
+    /* Filename cannot have a trailing '/' */
+    if (filename[0] == '\0' || filename[strlen(filename) - 1] == '/')
+    {
+        ESP_LOGE(TAG_HTTP, "Invalid filename : %s", filename);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid filename");
+        return ESP_FAIL;
+    }
+
+    struct stat file_stat;
+    if (stat(filepath, &file_stat) == -1)
+    {
+        ESP_LOGE(TAG_HTTP, "File does not exist : %s", filename);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG_HTTP, "Deleting file : %s", filename);
+    if (unlink(filepath) != 0)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to delete file");
+        return ESP_FAIL;
+    }
+    storage_changed();
+    resp_cache_invalidate();
+
+    /* Redirect to the listing of the directory the file was in */
+    strlcpy(location, filename, sizeof(location));
+    strrchr(location, '/')[1] = '\0';
+    httpd_resp_set_status(req, "303 See Other");
+    httpd_resp_set_hdr(req, "Location", location);
+    httpd_resp_sendstr(req, "File deleted successfully");
+    return ESP_OK;
+}
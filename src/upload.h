@@ -0,0 +1,19 @@
+/* Changes to storage files through the file server: uploads and deletes.
+ * Both handlers take the struct file_server_data as user_ctx */
+#pragma once
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/* Creates the upload writer task and its queues */
+esp_err_t start_upload_writer(void);
+
+/* HTTP POST handler for uploading a file to /upload/<path>. The body is
+ * written to <path>~ and renamed over <path> once complete, so a failed
+ * upload never leaves a truncated file behind. Uploads share one writer
+ * task, one at a time, others get a 503. Meant to run on an async worker */
+esp_err_t upload_post_handler(httpd_req_t *req);
+
+/* HTTP POST handler for deleting a file, posted by the directory listing's
+ * delete buttons. Redirects back to the listing */
+esp_err_t delete_post_handler(httpd_req_t *req);
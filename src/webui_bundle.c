@@ -0,0 +1,95 @@
+/* Read-only asset bundle, see webui_bundle.h */
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "webui_bundle.h"
+
+static const char *TAG_HTTP = "HTTP Server";
+
+#define WEBUI_BUNDLE_ENABLE 1 /* Set to 0 to serve everything from SPIFFS */
+#define WEBUI_BUNDLE_PARTITION "webui"
+#define WEBUI_BUNDLE_SUBTYPE 0x40
+#define WEBUI_BUNDLE_MAGIC 0x42495557 /* "WUIB" */
+#define WEBUI_BUNDLE_VERSION 2
+
+/* Image layout (little endian): header, sorted entry table, file data */
+struct webui_bundle_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;    /* Number of entries */
+    uint32_t size;     /* Total image size in bytes */
+    uint32_t reserved; /* Pads the header so the 64-bit entry hashes stay aligned */
+};
+
+static const struct webui_bundle_header *webui_bundle = NULL;
+
+esp_err_t init_webui_bundle(void)
+{
+#if WEBUI_BUNDLE_ENABLE
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, WEBUI_BUNDLE_SUBTYPE,
+                                                           WEBUI_BUNDLE_PARTITION);
+    if (!part)
+    {
+        ESP_LOGW(TAG_HTTP, "No '%s' partition, serving files from SPIFFS only", WEBUI_BUNDLE_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void *map_ptr;
+    esp_partition_mmap_handle_t map_handle;
+    esp_err_t ret = esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &map_ptr, &map_handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG_HTTP, "Failed to map asset bundle (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    const struct webui_bundle_header *hdr = map_ptr;
+    if (hdr->magic != WEBUI_BUNDLE_MAGIC || hdr->version != WEBUI_BUNDLE_VERSION || hdr->size > part->size ||
+        sizeof(*hdr) + hdr->count * sizeof(struct webui_bundle_entry) > hdr->size)
+    {
+        ESP_LOGW(TAG_HTTP, "Asset bundle partition is empty or invalid, serving files from SPIFFS only");
+        esp_partition_munmap(map_handle);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    const struct webui_bundle_entry *entries = (const struct webui_bundle_entry *)(hdr + 1);
+    for (int i = 0; i < hdr->count; i++)
+    {
+        if (entries[i].offset > hdr->size || entries[i].size > hdr->size - entries[i].offset ||
+            memchr(entries[i].path, '\0', WEBUI_BUNDLE_PATH_MAX) == NULL)
+        {
+            ESP_LOGE(TAG_HTTP, "Asset bundle entry %d is corrupt", i);
+            esp_partition_munmap(map_handle);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    webui_bundle = hdr;
+    ESP_LOGI(TAG_HTTP, "Asset bundle mapped: %d files, %u bytes", hdr->count, (unsigned)hdr->size);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static int webui_bundle_entry_cmp(const void *key, const void *elem)
+{
+    return strcmp(key, ((const struct webui_bundle_entry *)elem)->path);
+}
+
+const struct webui_bundle_entry *webui_bundle_find(const char *path)
+{
+    if (!webui_bundle)
+    {
+        return NULL;
+    }
+    return bsearch(path, webui_bundle + 1, webui_bundle->count, sizeof(struct webui_bundle_entry),
+                   webui_bundle_entry_cmp);
+}
+
+const char *webui_bundle_data(const struct webui_bundle_entry *entry)
+{
+    return (const char *)webui_bundle + entry->offset;
+}
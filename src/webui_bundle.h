@@ -0,0 +1,27 @@
+/* Read-only asset bundle packed by tools/webui_build.py. The image is
+ * flashed to its own partition and memory-mapped, so bundled files are
+ * served straight from flash without going through SPIFFS/VFS */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define WEBUI_BUNDLE_PATH_MAX 48
+
+struct webui_bundle_entry
+{
+    char path[WEBUI_BUNDLE_PATH_MAX]; /* e.g. "/index.html.gz", NUL terminated */
+    uint32_t offset;                  /* From the start of the image */
+    uint32_t size;
+    uint64_t hash; /* FNV-1a 64 of the contents, used as ETag */
+};
+
+/* Map the asset bundle partition. Without a valid bundle every file is
+ * looked up on SPIFFS, so failures here are not fatal */
+esp_err_t init_webui_bundle(void);
+
+/* Returns the bundle entry for path (relative to the base path) or NULL */
+const struct webui_bundle_entry *webui_bundle_find(const char *path);
+
+/* Contents of entry, entry->size bytes in mapped flash */
+const char *webui_bundle_data(const struct webui_bundle_entry *entry);
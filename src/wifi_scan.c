@@ -0,0 +1,609 @@
+/* Background WiFi scans and their cached results, see wifi_scan.h */
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_netif_net_stack.h"
+#include "esp_timer.h"
+#include "lwip/netif.h"
+#include "wifi_scan.h"
+
+static const char *TAG_STA = "WiFi Sta";
+
+/* Both tables are allocated once at startup; when a scan finds more
+ * networks than fit, the weakest are dropped, and the history of the
+ * network seen longest ago makes room for a new one */
+#define SCAN_MAX_NETS 96
+#define SCAN_HISTORY_NETS 96
+#define SCAN_HISTORY_LEN 8
+/* Scans without a sighting after which a network's history is discarded */
+#define SCAN_HISTORY_STALE 8
+#define SCAN_NO_HISTORY 0xFF
+
+/* An off-channel scan stalls the soft AP's clients, so while it has any,
+ * scans are time-sliced: one short scan per channel, with the radio back
+ * on the AP's channel for at least SCAN_HOME_MS between slices. While the
+ * AP carries more than SCAN_BUSY_KBPS during such a gap, the next slice is
+ * put off, doubling the gap up to SCAN_HOME_MAX_MS, after which the slice
+ * runs anyway so the scan still finishes. Without AP clients scans run
+ * back to back. SCAN_SLICED_ENABLE 0 always scans the unsliced way, e.g.
+ * to measure the difference with tools/webui_bench.py scanimpact */
+#define SCAN_SLICED_ENABLE 1
+#define SCAN_SLICE_PASSIVE 1
+#define SCAN_SLICE_PASSIVE_MS 110    /* Covers one beacon interval */
+#define SCAN_SLICE_ACTIVE_MIN_MS 30
+#define SCAN_SLICE_ACTIVE_MAX_MS 80
+#define SCAN_HOME_MS 100
+#define SCAN_HOME_MAX_MS 1600
+#define SCAN_BUSY_KBPS 32
+
+struct scan_history
+{
+    char ssid[33];
+    int8_t rssi[SCAN_HISTORY_LEN];
+    uint8_t head;         /* Next slot to write */
+    uint8_t len;
+    uint32_t scan;        /* scan_cache.started of the newest sample, 0 if the slot is free */
+};
+
+static struct
+{
+    struct scan_net *nets;         /* SCAN_MAX_NETS entries */
+    struct scan_history *history;  /* SCAN_HISTORY_NETS entries */
+    uint16_t count;
+    uint32_t seq;          /* Bumped whenever the records are replaced rather than added to */
+    uint32_t changes;      /* Bumped whenever a record is added or updated */
+    int64_t done_us;       /* esp_timer time the last scan completed, 0 if none has */
+    bool in_progress;
+    uint8_t walk_channel;  /* Channel a channel walk is scanning, or scans next after a gap; 0 for an all-channel scan */
+    uint8_t walk_last;     /* Last channel of the walk */
+    uint16_t walk_mask;    /* Bit n set when the walk covers channel n */
+    wifi_scan_record_cb targeted; /* Gets the records of a targeted scan, which are not kept */
+    uint32_t started;      /* Scans started */
+    uint32_t coalesced;    /* Requests that joined the scan already in progress */
+    bool sliced;           /* The scan in progress is time-sliced */
+    uint16_t home_ms;      /* Current gap between slices */
+    unsigned int traffic_mark; /* ap_traffic_bytes at the start of the gap */
+    int64_t gap_us;        /* esp_timer time the gap started */
+    int64_t start_us;      /* esp_timer time the scan started */
+    unsigned int start_traffic; /* ap_traffic_bytes when the scan started */
+    uint16_t slices;       /* Slices run by the scan in progress */
+    uint16_t deferred;     /* Slices it put off */
+    struct scan_stats last; /* The last completed scan */
+} scan_cache;
+
+static SemaphoreHandle_t scan_lock = NULL;
+
+/* Ends the gaps between slices */
+static esp_timer_handle_t scan_slice_timer = NULL;
+
+/* Bytes the soft AP has received and sent. The counter is
+ * fed by wrappers around the AP's lwIP input and linkoutput functions,
+ * which see forwarded (NAPT) traffic too */
+static atomic_uint ap_traffic_bytes = 0;
+static netif_input_fn ap_netif_input = NULL;
+static netif_linkoutput_fn ap_netif_linkoutput = NULL;
+
+static err_t ap_netif_count_input(struct pbuf *p, struct netif *netif)
+{
+    atomic_fetch_add(&ap_traffic_bytes, p->tot_len);
+    return ap_netif_input(p, netif);
+}
+
+static err_t ap_netif_count_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    atomic_fetch_add(&ap_traffic_bytes, p->tot_len);
+    return ap_netif_linkoutput(netif, p);
+}
+
+void ap_traffic_hook(esp_netif_t *ap_netif)
+{
+    struct netif *netif = ap_netif ? esp_netif_get_netif_impl(ap_netif) : NULL;
+
+    if (netif && netif->input != ap_netif_count_input)
+    {
+        ap_netif_input = netif->input;
+        ap_netif_linkoutput = netif->linkoutput;
+        netif->input = ap_netif_count_input;
+        netif->linkoutput = ap_netif_count_linkoutput;
+    }
+}
+
+/* A slice whose event does not fit in the loop's queue is tried again this much later */
+#define SCAN_POST_RETRY_MS 10
+
+ESP_EVENT_DEFINE_BASE(WIFI_SCAN_EVENT);
+
+/* Starts a non-blocking scan of channel, 0 for all channels: a short slice
+ * when the scan is time-sliced, otherwise a full active scan. Called with
+ * scan_lock held */
+static esp_err_t wifi_scan_start_channel(uint8_t channel)
+{
+    wifi_scan_config_t scan_config = {
+        .ssid = NULL,
+        .bssid = NULL,
+        .channel = channel,
+        .show_hidden = false,
+        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+        .scan_time.active.min = 100,
+        .scan_time.active.max = 300,
+    };
+    if (scan_cache.sliced)
+    {
+#if SCAN_SLICE_PASSIVE
+        scan_config.scan_type = WIFI_SCAN_TYPE_PASSIVE;
+        scan_config.scan_time.passive = SCAN_SLICE_PASSIVE_MS;
+#else
+        scan_config.scan_time.active.min = SCAN_SLICE_ACTIVE_MIN_MS;
+        scan_config.scan_time.active.max = SCAN_SLICE_ACTIVE_MAX_MS;
+#endif
+        scan_cache.slices++;
+    }
+    return esp_wifi_scan_start(&scan_config, false);
+}
+
+/* Ends the scan in progress, keeping its results if ok. Called with
+ * scan_lock held */
+static void wifi_scan_finish_locked(bool ok)
+{
+    const int64_t now = esp_timer_get_time();
+
+    scan_cache.in_progress = false;
+    scan_cache.walk_channel = 0;
+    /* The next scan keeps its records unless it is targeted too */
+    scan_cache.targeted = NULL;
+    if (ok)
+    {
+        scan_cache.done_us = now;
+    }
+    scan_cache.last.sliced = scan_cache.sliced;
+    scan_cache.last.slices = scan_cache.slices;
+    scan_cache.last.deferred = scan_cache.deferred;
+    scan_cache.last.duration_ms = (now - scan_cache.start_us) / 1000;
+    scan_cache.last.ap_bytes = atomic_load(&ap_traffic_bytes) - scan_cache.start_traffic;
+    ESP_LOGI(TAG_STA, "Scan finished in %lu ms, %s, %u slices, %u deferred, AP traffic %lu bytes",
+             (unsigned long)scan_cache.last.duration_ms, scan_cache.sliced ? "sliced" : "unsliced",
+             scan_cache.last.slices, scan_cache.last.deferred, (unsigned long)scan_cache.last.ap_bytes);
+}
+
+/* Starts a gap on the AP's channel before the next slice. Called with
+ * scan_lock held */
+static esp_err_t wifi_scan_gap_start_locked(void)
+{
+    scan_cache.traffic_mark = atomic_load(&ap_traffic_bytes);
+    scan_cache.gap_us = esp_timer_get_time();
+    return esp_timer_start_once(scan_slice_timer, scan_cache.home_ms * 1000ULL);
+}
+
+bool wifi_scan_slice(void)
+{
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    if (scan_cache.in_progress && scan_cache.walk_channel)
+    {
+        const uint64_t bytes = atomic_load(&ap_traffic_bytes) - scan_cache.traffic_mark;
+        const uint64_t elapsed_ms = (esp_timer_get_time() - scan_cache.gap_us) / 1000 + 1;
+        const bool busy = bytes * 1000 >= (uint64_t)SCAN_BUSY_KBPS * 1024 * elapsed_ms;
+
+        if (busy && scan_cache.home_ms < SCAN_HOME_MAX_MS)
+        {
+            scan_cache.home_ms = scan_cache.home_ms * 2 < SCAN_HOME_MAX_MS ? scan_cache.home_ms * 2 : SCAN_HOME_MAX_MS;
+            scan_cache.deferred++;
+            if (wifi_scan_gap_start_locked() != ESP_OK)
+            {
+                wifi_scan_finish_locked(true);
+            }
+        }
+        else
+        {
+            if (!busy)
+            {
+                scan_cache.home_ms = scan_cache.home_ms / 2 > SCAN_HOME_MS ? scan_cache.home_ms / 2 : SCAN_HOME_MS;
+            }
+            if (wifi_scan_start_channel(scan_cache.walk_channel) != ESP_OK)
+            {
+                /* E.g. the station started connecting, keep what was found */
+                wifi_scan_finish_locked(true);
+            }
+        }
+    }
+    const bool finished = !scan_cache.in_progress;
+    xSemaphoreGive(scan_lock);
+    return finished;
+}
+
+/* The slice starts a scan and may finish one, which then connects, none
+ * of which belongs on the esp_timer task */
+static void scan_slice_timer_cb(void *arg)
+{
+    if (esp_event_post(WIFI_SCAN_EVENT, WIFI_SCAN_EVENT_SLICE, NULL, 0, 0) != ESP_OK)
+    {
+        esp_timer_start_once(scan_slice_timer, SCAN_POST_RETRY_MS * 1000ULL);
+    }
+}
+
+esp_err_t init_wifi_scan(void)
+{
+    const esp_timer_create_args_t slice_timer_args = {
+        .callback = scan_slice_timer_cb,
+        .name = "scan_slice",
+    };
+
+    scan_lock = xSemaphoreCreateMutex();
+    scan_cache.nets = calloc(SCAN_MAX_NETS, sizeof(struct scan_net));
+    scan_cache.history = calloc(SCAN_HISTORY_NETS, sizeof(struct scan_history));
+    if (!scan_lock || !scan_cache.nets || !scan_cache.history ||
+        esp_timer_create(&slice_timer_args, &scan_slice_timer) != ESP_OK)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* Next channel of the walk after channel, 0 once it is done. Called with
+ * scan_lock held */
+static uint8_t wifi_scan_walk_next_locked(uint8_t channel)
+{
+    while (++channel <= scan_cache.walk_last)
+    {
+        if (scan_cache.walk_mask & (1U << channel))
+        {
+            return channel;
+        }
+    }
+    return 0;
+}
+
+/* Starts a scan of the channels in mask, every channel if 0, see
+ * wifi_scan_request(). Called with scan_lock held and no scan in progress */
+static esp_err_t wifi_scan_start_locked(bool walk, bool sliced, uint16_t mask)
+{
+    wifi_country_t country = {.schan = 1, .nchan = 13};
+    esp_wifi_get_country(&country);
+
+    scan_cache.walk_last = country.schan + country.nchan - 1;
+    scan_cache.walk_mask = ((1U << (scan_cache.walk_last + 1)) - (1U << country.schan)) & (mask ? mask : 0xFFFF);
+    const uint8_t first = wifi_scan_walk_next_locked(country.schan - 1);
+    if (!first)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    scan_cache.sliced = sliced;
+    scan_cache.home_ms = SCAN_HOME_MS;
+    scan_cache.slices = 0;
+    scan_cache.deferred = 0;
+    scan_cache.start_us = esp_timer_get_time();
+    scan_cache.start_traffic = atomic_load(&ap_traffic_bytes);
+    esp_err_t err = wifi_scan_start_channel(walk ? first : 0);
+    if (err == ESP_OK)
+    {
+        scan_cache.in_progress = true;
+        scan_cache.started++;
+        scan_cache.walk_channel = walk ? first : 0;
+    }
+    return err;
+}
+
+/* Whether a scan should be time-sliced: the AP has clients */
+static bool wifi_scan_sliced(void)
+{
+#if SCAN_SLICED_ENABLE
+    wifi_sta_list_t stations;
+    return esp_wifi_ap_get_sta_list(&stations) == ESP_OK && stations.num > 0;
+#else
+    return false;
+#endif
+}
+
+esp_err_t wifi_scan_request(bool walk)
+{
+    esp_err_t err = ESP_OK;
+    const bool sliced = wifi_scan_sliced();
+
+    /* Only a channel walk can return to the AP's channel in between */
+    walk = walk || sliced;
+
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    if (scan_cache.in_progress)
+    {
+        scan_cache.coalesced++;
+    }
+    else
+    {
+        scan_cache.targeted = NULL;
+        err = wifi_scan_start_locked(walk, sliced, 0);
+        if (err == ESP_OK && walk)
+        {
+            /* Records are appended channel by channel */
+            scan_cache.count = 0;
+            scan_cache.seq++;
+        }
+    }
+    xSemaphoreGive(scan_lock);
+    return err;
+}
+
+esp_err_t wifi_scan_request_targeted(uint16_t mask, wifi_scan_record_cb record_cb)
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    const bool sliced = wifi_scan_sliced();
+
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    if (!scan_cache.in_progress)
+    {
+        scan_cache.targeted = record_cb;
+        err = wifi_scan_start_locked(true, sliced, mask);
+    }
+    xSemaphoreGive(scan_lock);
+    return err;
+}
+
+/* Returns the history slot of ssid, taking over the one of the network
+ * seen longest ago if it has none. A network's samples are dropped once
+ * it has gone unseen for SCAN_HISTORY_STALE scans. Returns
+ * SCAN_NO_HISTORY when every slot belongs to a network of the current
+ * scan. Called with scan_lock held */
+static uint8_t scan_history_get_locked(const char *ssid)
+{
+    struct scan_history *oldest = NULL;
+
+    for (int i = 0; i < SCAN_HISTORY_NETS; i++)
+    {
+        struct scan_history *h = &scan_cache.history[i];
+        if (h->scan && strcmp(h->ssid, ssid) == 0)
+        {
+            if (scan_cache.started - h->scan > SCAN_HISTORY_STALE)
+            {
+                h->len = 0;
+            }
+            return i;
+        }
+        if (h->scan != scan_cache.started && (!oldest || h->scan < oldest->scan))
+        {
+            oldest = h;
+        }
+    }
+    if (!oldest)
+    {
+        return SCAN_NO_HISTORY;
+    }
+
+    strlcpy(oldest->ssid, ssid, sizeof(oldest->ssid));
+    oldest->head = 0;
+    oldest->len = 0;
+    oldest->scan = 0;
+    return oldest - scan_cache.history;
+}
+
+/* Mean of n samples, rounded to the nearest dB */
+static int8_t rssi_mean(int sum, int n)
+{
+    return (sum < 0 ? sum - n / 2 : sum + n / 2) / n;
+}
+
+/* Records net's RSSI as this scan's sample in its history, replacing the
+ * sample a weaker BSSID of the same network gave earlier in the scan, and
+ * updates its smoothed RSSI and trend. Called with scan_lock held */
+static void scan_history_sample_locked(struct scan_net *net)
+{
+    if (net->history == SCAN_NO_HISTORY)
+    {
+        net->rssi_avg = net->rssi;
+        net->trend = 0;
+        return;
+    }
+
+    struct scan_history *h = &scan_cache.history[net->history];
+    if (h->scan != scan_cache.started)
+    {
+        h->rssi[h->head] = net->rssi;
+        h->head = (h->head + 1) % SCAN_HISTORY_LEN;
+        h->len += h->len < SCAN_HISTORY_LEN;
+        h->scan = scan_cache.started;
+    }
+    else
+    {
+        h->rssi[(h->head + SCAN_HISTORY_LEN - 1) % SCAN_HISTORY_LEN] = net->rssi;
+    }
+
+    /* Oldest sample first */
+    const int first = (h->head + SCAN_HISTORY_LEN - h->len) % SCAN_HISTORY_LEN;
+    const int half = h->len / 2;
+    int sum = 0;
+    int older = 0;
+    int newer = 0;
+    for (int i = 0; i < h->len; i++)
+    {
+        const int rssi = h->rssi[(first + i) % SCAN_HISTORY_LEN];
+        sum += rssi;
+        if (i < half)
+        {
+            older += rssi;
+        }
+        else if (i >= h->len - half)
+        {
+            newer += rssi;
+        }
+    }
+    net->rssi_avg = rssi_mean(sum, h->len);
+    net->trend = half ? rssi_mean(newer - older, half) : 0;
+}
+
+/* Merges a driver record into the table: a new SSID takes a free entry,
+ * or the weakest one once the table is full; another BSSID of a known
+ * SSID adds to its AP count and channels, and becomes its main BSSID if it
+ * is stronger. Called with scan_lock held */
+static void scan_cache_add_locked(const wifi_ap_record_t *record)
+{
+    const char *ssid = (const char *)record->ssid;
+    const uint16_t channel_bit = record->primary < 16 ? 1U << record->primary : 0;
+    struct scan_net *net = NULL;
+
+    for (int i = 0; i < scan_cache.count; i++)
+    {
+        if (strcmp(scan_cache.nets[i].ssid, ssid) == 0)
+        {
+            net = &scan_cache.nets[i];
+            break;
+        }
+    }
+
+    if (net)
+    {
+        net->ap_count += net->ap_count < UINT8_MAX;
+        net->channels |= channel_bit;
+        net->change = ++scan_cache.changes;
+        if (record->rssi <= net->rssi)
+        {
+            return;
+        }
+    }
+    else
+    {
+        if (scan_cache.count < SCAN_MAX_NETS)
+        {
+            net = &scan_cache.nets[scan_cache.count++];
+        }
+        else
+        {
+            net = &scan_cache.nets[0];
+            for (int i = 1; i < SCAN_MAX_NETS; i++)
+            {
+                if (scan_cache.nets[i].rssi < net->rssi)
+                {
+                    net = &scan_cache.nets[i];
+                }
+            }
+            if (record->rssi <= net->rssi)
+            {
+                return;
+            }
+        }
+        strlcpy(net->ssid, ssid, sizeof(net->ssid));
+        net->ap_count = 1;
+        net->channels = channel_bit;
+        net->history = scan_history_get_locked(ssid);
+        net->change = ++scan_cache.changes;
+    }
+
+    memcpy(net->bssid, record->bssid, sizeof(net->bssid));
+    net->rssi = record->rssi;
+    net->channel = record->primary;
+    net->authmode = record->authmode;
+    scan_history_sample_locked(net);
+}
+
+bool wifi_scan_done(const wifi_event_sta_scan_done_t *event)
+{
+    wifi_ap_record_t record;
+    int count = 0;
+
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    if (!scan_cache.in_progress)
+    {
+        /* Not a scan of ours, its records are not ours to take either */
+        xSemaphoreGive(scan_lock);
+        return false;
+    }
+    const uint8_t channel = scan_cache.walk_channel;
+    if (event->status == 0)
+    {
+        if (!channel && !scan_cache.targeted)
+        {
+            scan_cache.count = 0;
+            scan_cache.seq++;
+        }
+        /* Pops the driver's records one at a time, however many there are */
+        while (esp_wifi_scan_get_ap_record(&record) == ESP_OK)
+        {
+            if (scan_cache.targeted)
+            {
+                scan_cache.targeted(&record);
+            }
+            else
+            {
+                scan_cache_add_locked(&record);
+            }
+            count++;
+        }
+    }
+    /* Free whatever the driver still holds */
+    esp_wifi_clear_ap_list();
+
+    const uint8_t next = channel ? wifi_scan_walk_next_locked(channel) : 0;
+    if (next && scan_cache.sliced)
+    {
+        /* Back to the AP's channel until the timer starts the next slice */
+        scan_cache.walk_channel = next;
+        if (wifi_scan_gap_start_locked() != ESP_OK)
+        {
+            wifi_scan_finish_locked(true);
+        }
+    }
+    else if (next && wifi_scan_start_channel(next) == ESP_OK)
+    {
+        scan_cache.walk_channel = next;
+    }
+    else
+    {
+        wifi_scan_finish_locked(channel || event->status == 0);
+    }
+    const bool finished = !scan_cache.in_progress;
+    xSemaphoreGive(scan_lock);
+
+    ESP_LOGI(TAG_STA, "Scan done, channel %d, status %d, %d networks", channel, (int)event->status, count);
+    return finished;
+}
+
+int scan_cache_copy(uint32_t seq, uint32_t since, int *index, struct scan_net *batch)
+{
+    int n = -1;
+
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    if (scan_cache.seq == seq)
+    {
+        n = 0;
+        for (; *index < scan_cache.count && n < SCAN_STREAM_BATCH; (*index)++)
+        {
+            if (scan_cache.nets[*index].change > since)
+            {
+                batch[n++] = scan_cache.nets[*index];
+            }
+        }
+    }
+    xSemaphoreGive(scan_lock);
+    return n;
+}
+
+void wifi_scan_status(struct scan_status *status)
+{
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    status->seq = scan_cache.seq;
+    status->changes = scan_cache.changes;
+    status->count = scan_cache.count;
+    status->in_progress = scan_cache.in_progress;
+    status->done_us = scan_cache.done_us;
+    status->walk_channel = scan_cache.walk_channel;
+    status->walk_last = scan_cache.walk_last;
+    status->last = scan_cache.last;
+    xSemaphoreGive(scan_lock);
+}
+
+bool wifi_scan_find(const char *ssid, struct scan_net *net)
+{
+    bool found = false;
+
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    for (int i = 0; i < scan_cache.count && !found; i++)
+    {
+        if (strcmp(scan_cache.nets[i].ssid, ssid) == 0)
+        {
+            *net = scan_cache.nets[i];
+            found = true;
+        }
+    }
+    xSemaphoreGive(scan_lock);
+    return found;
+}
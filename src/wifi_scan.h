@@ -0,0 +1,114 @@
+/* WiFi scan results. Scans run in the background and finish with
+ * WIFI_EVENT_SCAN_DONE, which copies the records here; /api/wifi/scan
+ * answers from the last completed scan without waiting.
+ *
+ * A scan either covers all channels at once, or walks them one scan per
+ * channel, adding each channel's records as it completes so that
+ * /api/wifi/scan/stream can push them to the browser straight away.
+ *
+ * Records are merged by SSID, so a mesh or multi-AP network is one entry
+ * with its strongest BSSID, the channels it was seen on and its AP count.
+ * Each network's strongest RSSI per scan also goes into a small history
+ * ring that outlives the scan, from which a smoothed RSSI and a trend are
+ * derived.
+ *
+ * Everything except the HTTP readers (wifi_scan_status(),
+ * wifi_scan_find(), scan_cache_copy()) runs in the default event loop */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+
+/* Posted by the slice timer, handled with wifi_scan_slice() */
+ESP_EVENT_DECLARE_BASE(WIFI_SCAN_EVENT);
+
+enum
+{
+    WIFI_SCAN_EVENT_SLICE, /* The gap before the next scan slice is over */
+};
+
+struct scan_net
+{
+    char ssid[33];
+    uint8_t bssid[6];     /* Strongest BSSID */
+    int8_t rssi;          /* Of the strongest BSSID */
+    int8_t rssi_avg;      /* Mean over the history ring */
+    int8_t trend;         /* dB, newer half of the ring against the older half */
+    uint8_t channel;      /* Of the strongest BSSID */
+    uint8_t authmode;     /* wifi_auth_mode_t */
+    uint8_t ap_count;     /* BSSIDs seen */
+    uint16_t channels;    /* Bit n set when a BSSID was seen on channel n */
+    uint8_t history;      /* Index into scan_cache.history, SCAN_NO_HISTORY if none */
+    uint32_t change;      /* scan_cache.changes when the entry was last modified */
+};
+
+struct scan_stats
+{
+    bool sliced;
+    uint16_t slices;
+    uint16_t deferred;    /* Slices put off because the AP was busy */
+    uint32_t duration_ms;
+    uint32_t ap_bytes;    /* AP traffic while the scan ran */
+};
+
+/* State of the cached results, copied out under the scan lock */
+struct scan_status
+{
+    uint32_t seq;         /* Bumped whenever the records are replaced rather than added to */
+    uint32_t changes;     /* Bumped whenever a record is added or updated */
+    uint16_t count;
+    bool in_progress;
+    int64_t done_us;      /* esp_timer time the last scan completed, 0 if none has */
+    uint8_t walk_channel; /* Channel a channel walk is at, 0 for an all-channel scan */
+    uint8_t walk_last;    /* Last channel of the walk */
+    struct scan_stats last; /* The last completed scan */
+};
+
+/* Gets every record of a targeted scan, with the scan lock held */
+typedef void (*wifi_scan_record_cb)(const wifi_ap_record_t *record);
+
+esp_err_t init_wifi_scan(void);
+
+/* Hooks the traffic counter that paces time-sliced scans into the AP
+ * netif. The lwIP netif only exists once the AP has started, so this runs
+ * when a client joins */
+void ap_traffic_hook(esp_netif_t *ap_netif);
+
+/* Starts a background scan, walking the channels one by one if walk is
+ * set, unless one is already running, in which case the caller simply
+ * gets that scan's results */
+esp_err_t wifi_scan_request(bool walk);
+
+/* Starts a roaming scan of the channels in mask, walked one by one. Its
+ * records go to record_cb and leave the cached results alone. Fails while
+ * another scan is running */
+esp_err_t wifi_scan_request_targeted(uint16_t mask, wifi_scan_record_cb record_cb);
+
+/* WIFI_EVENT_SCAN_DONE: store the results, and move a channel walk on to
+ * the next channel. Returns true once the scan is over. Scans this module
+ * did not start are ignored and return false */
+bool wifi_scan_done(const wifi_event_sta_scan_done_t *event);
+
+/* WIFI_SCAN_EVENT_SLICE, the end of a gap between slices: scans the
+ * next channel, or, if the AP clients moved data during the gap, waits
+ * longer first. Returns true if that ended the scan */
+bool wifi_scan_slice(void);
+
+void wifi_scan_status(struct scan_status *status);
+
+/* Copies the cached record of ssid into net. Returns false if the last
+ * scan did not see it */
+bool wifi_scan_find(const char *ssid, struct scan_net *net);
+
+/* Records copied out of the scan cache at a time by the scan handlers,
+ * which never hold scan_lock while writing to the socket */
+#define SCAN_STREAM_BATCH 4
+
+/* Copies up to SCAN_STREAM_BATCH records modified after change number
+ * since into batch, searching from *index and moving it past them.
+ * Returns how many, or -1 if the records have been replaced since seq */
+int scan_cache_copy(uint32_t seq, uint32_t since, int *index, struct scan_net *batch);
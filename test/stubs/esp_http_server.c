@@ -0,0 +1,34 @@
+/* Host stand-in for the response functions, see esp_http_server.h */
+#include <string.h>
+#include "esp_http_server.h"
+
+struct httpd_stub httpd_stub;
+
+static void httpd_stub_append(const char *buf, size_t len)
+{
+    if (len > sizeof(httpd_stub.body) - httpd_stub.len)
+    {
+        len = sizeof(httpd_stub.body) - httpd_stub.len;
+    }
+    memcpy(httpd_stub.body + httpd_stub.len, buf, len);
+    httpd_stub.len += len;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    httpd_stub_append(buf, buf_len);
+    httpd_stub.sends++;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    if (!buf)
+    {
+        httpd_stub.terminated = true;
+        return ESP_OK;
+    }
+    httpd_stub_append(buf, buf_len);
+    httpd_stub.chunks++;
+    return ESP_OK;
+}
@@ -0,0 +1,28 @@
+/* Host stand-in for the ESP-IDF header, just what the modules under test
+ * use. Responses are recorded in httpd_stub rather than sent */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+typedef struct httpd_req
+{
+    int sockfd;
+} httpd_req_t;
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len);
+
+/* What was sent since the test last cleared it */
+struct httpd_stub
+{
+    char body[1024];
+    size_t len;
+    int sends;        /* httpd_resp_send() calls */
+    int chunks;       /* httpd_resp_send_chunk() calls with data */
+    bool terminated;  /* The terminating empty chunk went out */
+};
+
+extern struct httpd_stub httpd_stub;
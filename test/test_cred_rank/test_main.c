@@ -0,0 +1,108 @@
+/* Host tests of the saved network ranking in src/cred_rank.c */
+#include <string.h>
+#include <unity.h>
+#include "cred_rank.h"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static struct sta_candidate candidate(const char *ssid, uint8_t priority, int8_t rssi)
+{
+    struct sta_candidate c = {.priority = priority, .rssi = rssi};
+
+    strncpy(c.ssid, ssid, sizeof(c.ssid) - 1);
+    return c;
+}
+
+static void test_rank_by_priority(void)
+{
+    struct sta_candidate list[] = {
+        candidate("low", 10, -40),
+        candidate("high", 200, -85),
+        candidate("default", 100, -60),
+    };
+
+    cred_rank(list, 3);
+    TEST_ASSERT_EQUAL_STRING("high", list[0].ssid);
+    TEST_ASSERT_EQUAL_STRING("default", list[1].ssid);
+    TEST_ASSERT_EQUAL_STRING("low", list[2].ssid);
+}
+
+static void test_rank_by_rssi_within_priority(void)
+{
+    struct sta_candidate list[] = {
+        candidate("weak", 100, -80),
+        candidate("other", 50, -30),
+        candidate("strong", 100, -45),
+        candidate("middle", 100, -60),
+    };
+
+    cred_rank(list, 4);
+    TEST_ASSERT_EQUAL_STRING("strong", list[0].ssid);
+    TEST_ASSERT_EQUAL_STRING("middle", list[1].ssid);
+    TEST_ASSERT_EQUAL_STRING("weak", list[2].ssid);
+    TEST_ASSERT_EQUAL_STRING("other", list[3].ssid);
+}
+
+static void test_rank_stable_on_ties(void)
+{
+    struct sta_candidate list[] = {
+        candidate("first", 100, -60),
+        candidate("better", 100, -50),
+        candidate("second", 100, -60),
+        candidate("third", 100, -60),
+    };
+
+    cred_rank(list, 4);
+    TEST_ASSERT_EQUAL_STRING("better", list[0].ssid);
+    TEST_ASSERT_EQUAL_STRING("first", list[1].ssid);
+    TEST_ASSERT_EQUAL_STRING("second", list[2].ssid);
+    TEST_ASSERT_EQUAL_STRING("third", list[3].ssid);
+}
+
+static void test_rank_keeps_the_records(void)
+{
+    struct sta_candidate list[] = {
+        candidate("a", 1, -70),
+        candidate("b", 2, -70),
+    };
+    list[1].channel = 11;
+    list[1].bssid[5] = 0xbb;
+
+    cred_rank(list, 2);
+    TEST_ASSERT_EQUAL_STRING("b", list[0].ssid);
+    TEST_ASSERT_EQUAL_UINT(11, list[0].channel);
+    TEST_ASSERT_EQUAL_UINT(0xbb, list[0].bssid[5]);
+    TEST_ASSERT_EQUAL_STRING("a", list[1].ssid);
+}
+
+static void test_rank_short_lists(void)
+{
+    struct sta_candidate list[] = {
+        candidate("only", 100, -60),
+        candidate("untouched", 255, 0),
+    };
+
+    cred_rank(list, 0);
+    TEST_ASSERT_EQUAL_STRING("only", list[0].ssid);
+    /* Entries past count are not looked at */
+    cred_rank(list, 1);
+    TEST_ASSERT_EQUAL_STRING("only", list[0].ssid);
+    TEST_ASSERT_EQUAL_STRING("untouched", list[1].ssid);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_rank_by_priority);
+    RUN_TEST(test_rank_by_rssi_within_priority);
+    RUN_TEST(test_rank_stable_on_ties);
+    RUN_TEST(test_rank_keeps_the_records);
+    RUN_TEST(test_rank_short_lists);
+    return UNITY_END();
+}
@@ -0,0 +1,194 @@
+/* Host tests of the request header parsers and the MIME type lookup in
+ * src/http_util.c */
+#include <stdio.h>
+#include <unity.h>
+#include "http_util.h"
+#include "mime_types.h"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void test_range_first_last(void)
+{
+    struct byte_range range;
+
+    TEST_ASSERT_EQUAL_INT(1, parse_byte_range("bytes=0-99", 1000, &range));
+    TEST_ASSERT_EQUAL_UINT(0, range.start);
+    TEST_ASSERT_EQUAL_UINT(99, range.end);
+    TEST_ASSERT_EQUAL_INT(1, parse_byte_range("bytes=999-999", 1000, &range));
+    TEST_ASSERT_EQUAL_UINT(999, range.start);
+    TEST_ASSERT_EQUAL_UINT(999, range.end);
+}
+
+static void test_range_open_ended(void)
+{
+    struct byte_range range;
+
+    TEST_ASSERT_EQUAL_INT(1, parse_byte_range("bytes=500-", 1000, &range));
+    TEST_ASSERT_EQUAL_UINT(500, range.start);
+    TEST_ASSERT_EQUAL_UINT(999, range.end);
+}
+
+static void test_range_end_clamped_to_size(void)
+{
+    struct byte_range range;
+
+    TEST_ASSERT_EQUAL_INT(1, parse_byte_range("bytes=900-5000", 1000, &range));
+    TEST_ASSERT_EQUAL_UINT(900, range.start);
+    TEST_ASSERT_EQUAL_UINT(999, range.end);
+}
+
+static void test_range_suffix(void)
+{
+    struct byte_range range;
+
+    TEST_ASSERT_EQUAL_INT(1, parse_byte_range("bytes=-100", 1000, &range));
+    TEST_ASSERT_EQUAL_UINT(900, range.start);
+    TEST_ASSERT_EQUAL_UINT(999, range.end);
+    /* A suffix longer than the file is the whole file */
+    TEST_ASSERT_EQUAL_INT(1, parse_byte_range("bytes=-5000", 1000, &range));
+    TEST_ASSERT_EQUAL_UINT(0, range.start);
+    TEST_ASSERT_EQUAL_UINT(999, range.end);
+}
+
+static void test_range_unsatisfiable(void)
+{
+    struct byte_range range;
+
+    TEST_ASSERT_EQUAL_INT(-1, parse_byte_range("bytes=1000-", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(-1, parse_byte_range("bytes=2000-3000", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(-1, parse_byte_range("bytes=-0", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(-1, parse_byte_range("bytes=0-", 0, &range));
+    TEST_ASSERT_EQUAL_INT(-1, parse_byte_range("bytes=-10", 0, &range));
+}
+
+static void test_range_ignored(void)
+{
+    struct byte_range range;
+
+    /* Malformed and multi-range requests get the whole file */
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("items=0-99", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=0-99,200-299", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=99-0", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=-", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=abc-", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=0-99x", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=-10x", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes= 0-99", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=0- 5", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=0-+5", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=- 5", 1000, &range));
+    TEST_ASSERT_EQUAL_INT(0, parse_byte_range("bytes=-+5", 1000, &range));
+}
+
+static void test_etag_exact(void)
+{
+    TEST_ASSERT_TRUE(etag_matches("\"0123456789abcdef\"", "\"0123456789abcdef\""));
+    TEST_ASSERT_FALSE(etag_matches("\"0123456789abcdee\"", "\"0123456789abcdef\""));
+    /* The quotes are part of the tag */
+    TEST_ASSERT_FALSE(etag_matches("0123456789abcdef", "\"0123456789abcdef\""));
+}
+
+static void test_etag_list(void)
+{
+    TEST_ASSERT_TRUE(etag_matches("\"a\", \"b\",\"c\"", "\"b\""));
+    TEST_ASSERT_TRUE(etag_matches("\"a\" , \"c\" ", "\"c\""));
+    TEST_ASSERT_FALSE(etag_matches("\"a\", \"bc\"", "\"b\""));
+    TEST_ASSERT_FALSE(etag_matches("", "\"a\""));
+}
+
+static void test_etag_weak_and_wildcard(void)
+{
+    /* If-None-Match uses the weak comparison */
+    TEST_ASSERT_TRUE(etag_matches("W/\"a\"", "\"a\""));
+    TEST_ASSERT_TRUE(etag_matches("\"x\", W/\"a\"", "\"a\""));
+    TEST_ASSERT_TRUE(etag_matches("*", "\"a\""));
+    TEST_ASSERT_TRUE(etag_matches(" * ", "\"a\""));
+    TEST_ASSERT_FALSE(etag_matches("\"*\"", "\"a\""));
+}
+
+static void test_accept_encoding_listed(void)
+{
+    TEST_ASSERT_TRUE(accept_encoding_allows("gzip, deflate, br", "br"));
+    TEST_ASSERT_TRUE(accept_encoding_allows("gzip, deflate, br", "gzip"));
+    TEST_ASSERT_TRUE(accept_encoding_allows("GZip", "gzip"));
+    TEST_ASSERT_FALSE(accept_encoding_allows("gzip, deflate", "br"));
+    TEST_ASSERT_FALSE(accept_encoding_allows("", "gzip"));
+}
+
+static void test_accept_encoding_no_prefix_match(void)
+{
+    TEST_ASSERT_FALSE(accept_encoding_allows("x-gzip", "gzip"));
+    TEST_ASSERT_FALSE(accept_encoding_allows("gzipped", "gzip"));
+    TEST_ASSERT_FALSE(accept_encoding_allows("brotli", "br"));
+}
+
+static void test_accept_encoding_qvalues(void)
+{
+    TEST_ASSERT_TRUE(accept_encoding_allows("br;q=1.0, gzip;q=0.5", "gzip"));
+    TEST_ASSERT_TRUE(accept_encoding_allows("gzip ; q=0.001", "gzip"));
+    TEST_ASSERT_FALSE(accept_encoding_allows("gzip;q=0", "gzip"));
+    TEST_ASSERT_FALSE(accept_encoding_allows("br, gzip;q=0.0", "gzip"));
+    TEST_ASSERT_FALSE(accept_encoding_allows("gzip;q=0.000, br", "gzip"));
+    TEST_ASSERT_TRUE(accept_encoding_allows("gzip;q=0, br", "br"));
+}
+
+static void test_mime_every_table_entry(void)
+{
+    char name[8 + MIME_EXT_MAX];
+
+    /* Every extension must land in its own slot under the generated seed */
+    for (int i = 0; i < MIME_TABLE_SIZE; i++)
+    {
+        if (mime_table[i].type)
+        {
+            snprintf(name, sizeof(name), "file.%s", mime_table[i].ext);
+            TEST_ASSERT_EQUAL_STRING(mime_table[i].type, content_type_from_file(name));
+        }
+    }
+}
+
+static void test_mime_paths(void)
+{
+    TEST_ASSERT_EQUAL_STRING("text/html", content_type_from_file("/spiffs/index.html"));
+    TEST_ASSERT_EQUAL_STRING("text/html", content_type_from_file("/INDEX.HTML"));
+    TEST_ASSERT_EQUAL_STRING("text/css", content_type_from_file("/a.b/style.min.css"));
+    TEST_ASSERT_EQUAL_STRING("application/manifest+json", content_type_from_file("/app.webmanifest"));
+}
+
+static void test_mime_unknown(void)
+{
+    TEST_ASSERT_EQUAL_STRING("application/octet-stream", content_type_from_file("/README"));
+    TEST_ASSERT_EQUAL_STRING("application/octet-stream", content_type_from_file("/file."));
+    TEST_ASSERT_EQUAL_STRING("application/octet-stream", content_type_from_file("/a.html/README"));
+    TEST_ASSERT_EQUAL_STRING("application/octet-stream", content_type_from_file("/file.xyz"));
+    TEST_ASSERT_EQUAL_STRING("application/octet-stream", content_type_from_file("/file.webmanifests"));
+    TEST_ASSERT_EQUAL_STRING("application/octet-stream", content_type_from_file("/file.averyverylongextension"));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_range_first_last);
+    RUN_TEST(test_range_open_ended);
+    RUN_TEST(test_range_end_clamped_to_size);
+    RUN_TEST(test_range_suffix);
+    RUN_TEST(test_range_unsatisfiable);
+    RUN_TEST(test_range_ignored);
+    RUN_TEST(test_etag_exact);
+    RUN_TEST(test_etag_list);
+    RUN_TEST(test_etag_weak_and_wildcard);
+    RUN_TEST(test_accept_encoding_listed);
+    RUN_TEST(test_accept_encoding_no_prefix_match);
+    RUN_TEST(test_accept_encoding_qvalues);
+    RUN_TEST(test_mime_every_table_entry);
+    RUN_TEST(test_mime_paths);
+    RUN_TEST(test_mime_unknown);
+    return UNITY_END();
+}
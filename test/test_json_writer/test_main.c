@@ -0,0 +1,157 @@
+/* Host tests of the chunk writer and the JSON writer in src/json_writer.c */
+#include <limits.h>
+#include <string.h>
+#include <unity.h>
+#include "json_writer.h"
+
+static httpd_req_t req;
+
+void setUp(void)
+{
+    memset(&httpd_stub, 0, sizeof(httpd_stub));
+}
+
+void tearDown(void)
+{
+}
+
+/* Writes value with json_str() into a buffer-only writer */
+static const char *json_str_of(const char *value)
+{
+    static char out[128];
+    struct chunk_writer w = {.buf = out, .size = sizeof(out) - 1};
+    struct json_writer j = {.out = &w};
+
+    json_str(&j, NULL, value);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, w.err);
+    out[w.len] = '\0';
+    return out;
+}
+
+static void test_str_plain(void)
+{
+    TEST_ASSERT_EQUAL_STRING("\"\"", json_str_of(""));
+    TEST_ASSERT_EQUAL_STRING("\"my network\"", json_str_of("my network"));
+    /* UTF-8 goes through as it is */
+    TEST_ASSERT_EQUAL_STRING("\"caf\xc3\xa9\"", json_str_of("caf\xc3\xa9"));
+}
+
+static void test_str_escapes(void)
+{
+    TEST_ASSERT_EQUAL_STRING("\"a\\\"b\"", json_str_of("a\"b"));
+    TEST_ASSERT_EQUAL_STRING("\"a\\\\b\"", json_str_of("a\\b"));
+    TEST_ASSERT_EQUAL_STRING("\"\\\"\\\\\\\"\"", json_str_of("\"\\\""));
+    TEST_ASSERT_EQUAL_STRING("\"a\\u000ab\\u0009\"", json_str_of("a\nb\t"));
+    TEST_ASSERT_EQUAL_STRING("\"\\u0001\\u001f \"", json_str_of("\x01\x1f "));
+    /* DEL and bytes above ASCII need no escaping */
+    TEST_ASSERT_EQUAL_STRING("\"\x7f\xff\"", json_str_of("\x7f\xff"));
+}
+
+static void test_html_escapes(void)
+{
+    char out[64];
+    struct chunk_writer w = {.buf = out, .size = sizeof(out) - 1};
+
+    chunk_writer_put_html(&w, "<a href=\"x\">&</a>'");
+    out[w.len] = '\0';
+    TEST_ASSERT_EQUAL_STRING("&lt;a href=&quot;x&quot;&gt;&amp;&lt;/a&gt;'", out);
+}
+
+static void test_nesting_and_commas(void)
+{
+    char out[256];
+    struct chunk_writer w = {.buf = out, .size = sizeof(out) - 1};
+    struct json_writer j = {.out = &w};
+
+    json_object_begin(&j, NULL);
+    json_int(&j, "a", 1);
+    json_array_begin(&j, "list");
+    json_int(&j, NULL, 1);
+    json_object_begin(&j, NULL);
+    json_object_end(&j);
+    json_array_begin(&j, NULL);
+    json_array_end(&j);
+    json_bool(&j, NULL, false);
+    json_array_end(&j);
+    json_object_begin(&j, "empty");
+    json_object_end(&j);
+    json_bool(&j, "ok", true);
+    json_object_end(&j);
+    out[w.len] = '\0';
+    TEST_ASSERT_EQUAL_STRING("{\"a\":1,\"list\":[1,{},[],false],\"empty\":{},\"ok\":true}", out);
+}
+
+static void test_int_limits(void)
+{
+    char out[128];
+    struct chunk_writer w = {.buf = out, .size = sizeof(out) - 1};
+    struct json_writer j = {.out = &w};
+
+    json_array_begin(&j, NULL);
+    json_int(&j, NULL, 0);
+    json_int(&j, NULL, -42);
+    json_int(&j, NULL, LLONG_MAX);
+    json_int(&j, NULL, LLONG_MIN);
+    json_array_end(&j);
+    out[w.len] = '\0';
+    TEST_ASSERT_EQUAL_STRING("[0,-42,9223372036854775807,-9223372036854775808]", out);
+}
+
+static void test_buffer_only_overflow(void)
+{
+    char out[8];
+    struct chunk_writer w = {.buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+
+    json_str(&j, NULL, "longer than the buffer");
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NO_MEM, w.err);
+}
+
+static void test_finish_single_send(void)
+{
+    char out[64];
+    struct chunk_writer w = {.req = &req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+
+    json_object_begin(&j, NULL);
+    json_str(&j, "k", "v");
+    json_object_end(&j);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, chunk_writer_finish(&w));
+    TEST_ASSERT_EQUAL_INT(1, httpd_stub.sends);
+    TEST_ASSERT_EQUAL_INT(0, httpd_stub.chunks);
+    TEST_ASSERT_EQUAL_INT(9, httpd_stub.len);
+    TEST_ASSERT_EQUAL_STRING_LEN("{\"k\":\"v\"}", httpd_stub.body, httpd_stub.len);
+}
+
+static void test_finish_chunked(void)
+{
+    char out[8];
+    struct chunk_writer w = {.req = &req, .buf = out, .size = sizeof(out)};
+    struct json_writer j = {.out = &w};
+    const char *expected = "{\"ssid\":\"a \\\"quoted\\\" name\",\"rssi\":-61}";
+
+    json_object_begin(&j, NULL);
+    json_str(&j, "ssid", "a \"quoted\" name");
+    json_int(&j, "rssi", -61);
+    json_object_end(&j);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, chunk_writer_finish(&w));
+    TEST_ASSERT_EQUAL_INT(0, httpd_stub.sends);
+    TEST_ASSERT_EQUAL_INT((strlen(expected) + sizeof(out) - 1) / sizeof(out), httpd_stub.chunks);
+    TEST_ASSERT_TRUE(httpd_stub.terminated);
+    TEST_ASSERT_EQUAL_INT(strlen(expected), httpd_stub.len);
+    TEST_ASSERT_EQUAL_STRING_LEN(expected, httpd_stub.body, httpd_stub.len);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_str_plain);
+    RUN_TEST(test_str_escapes);
+    RUN_TEST(test_html_escapes);
+    RUN_TEST(test_nesting_and_commas);
+    RUN_TEST(test_int_limits);
+    RUN_TEST(test_buffer_only_overflow);
+    RUN_TEST(test_finish_single_send);
+    RUN_TEST(test_finish_chunked);
+    return UNITY_END();
+}
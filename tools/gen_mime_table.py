@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# Generates src/mime_types.h, the perfect hash table content_type_from_file()
+# in src/http_util.c uses to map a file extension to its MIME type.
+#
+# Edit MIME_TYPES below and rerun:
+#   python tools/gen_mime_table.py
+#
+# The script searches for a hash seed under which every extension lands in
+# its own slot, so a lookup is one hash and one string compare.
+
+import os
+import sys
+
+MIME_TYPES = {
+    "html": "text/html",
+    "htm": "text/html",
+    "css": "text/css",
+    "js": "application/javascript",
+    "mjs": "application/javascript",
+    "json": "application/json",
+    "map": "application/json",
+    "webmanifest": "application/manifest+json",
+    "txt": "text/plain",
+    "log": "text/plain",
+    "csv": "text/csv",
+    "xml": "application/xml",
+    "svg": "image/svg+xml",
+    "png": "image/png",
+    "jpg": "image/jpeg",
+    "jpeg": "image/jpeg",
+    "gif": "image/gif",
+    "ico": "image/x-icon",
+    "webp": "image/webp",
+    "avif": "image/avif",
+    "bmp": "image/bmp",
+    "woff": "font/woff",
+    "woff2": "font/woff2",
+    "ttf": "font/ttf",
+    "otf": "font/otf",
+    "wasm": "application/wasm",
+    "gz": "application/gzip",
+    "br": "application/octet-stream",
+    "zip": "application/zip",
+    "pdf": "application/pdf",
+    "bin": "application/octet-stream",
+    "pcap": "application/vnd.tcpdump.pcap",
+    "mp3": "audio/mpeg",
+    "wav": "audio/wav",
+    "mp4": "video/mp4",
+    "webm": "video/webm",
+}
+
+TABLE_BITS = 6
+TABLE_SIZE = 1 << TABLE_BITS
+EXT_MAX = 12  # Longest extension + NUL, must match MIME_EXT_MAX
+
+
+def mime_hash(ext, seed):
+    """FNV-1a 32 with the seed as offset basis, same as mime_hash() in src/http_util.c.
+    The slot is taken from the top bits, the low bits of a product only
+    depend on the low bits of the seed"""
+    h = seed
+    for c in ext.encode():
+        h = ((h ^ c) * 0x01000193) & 0xFFFFFFFF
+    return h >> (32 - TABLE_BITS)
+
+
+def find_seed():
+    for seed in range(0x811C9DC5, 0x811C9DC5 + 1000000):
+        slots = set()
+        for ext in MIME_TYPES:
+            slot = mime_hash(ext, seed)
+            if slot in slots:
+                break
+            slots.add(slot)
+        else:
+            return seed
+    raise RuntimeError("no collision-free seed found, increase TABLE_SIZE")
+
+
+def main():
+    assert all(len(ext) < EXT_MAX and ext == ext.lower() for ext in MIME_TYPES)
+    seed = find_seed()
+    slots = sorted((mime_hash(ext, seed), ext, mime) for ext, mime in MIME_TYPES.items())
+
+    lines = [
+        "/* Generated by tools/gen_mime_table.py, do not edit */",
+        "#pragma once",
+        "",
+        "#define MIME_HASH_SEED 0x%08xU" % seed,
+        "#define MIME_TABLE_BITS %d" % TABLE_BITS,
+        "#define MIME_TABLE_SIZE (1 << MIME_TABLE_BITS)",
+        "#define MIME_EXT_MAX %d" % EXT_MAX,
+        "",
+        "static const struct",
+        "{",
+        "    char ext[MIME_EXT_MAX];",
+        "    const char *type;",
+        "} mime_table[MIME_TABLE_SIZE] = {",
+    ]
+    for slot, ext, mime in slots:
+        lines.append('    [%d] = {"%s", "%s"},' % (slot, ext, mime))
+    lines.append("};")
+
+    out = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "src", "mime_types.h")
+    with open(out, "w", newline="\n") as f:
+        f.write("\n".join(lines) + "\n")
+    print("%s: %d types, seed 0x%08x" % (out, len(MIME_TYPES), seed))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
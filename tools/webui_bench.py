@@ -0,0 +1,566 @@
+#!/usr/bin/env python3
+# Host-side measurements for the web UI served by the device.
+#
+# Connect to the device's soft AP (or reach it over STA) and run e.g.:
+#   python tools/webui_bench.py --host 192.168.4.1 load
+#
+# Commands:
+#   load   fetch the UI the way a browser does on first load, once as the
+#          separate files and once as the single inlined page at "/", each
+#          without and with "Accept-Encoding: gzip", and report requests,
+#          bytes on the wire and time-to-load for each
+#   reload fetch the UI assets, then fetch them again revalidating with
+#          If-None-Match the way a browser reload does, and report status,
+#          bytes and time of the second round
+#   concurrent
+#          download every file in WEBUI/ (plain and gzip) from 1, 2, 4 and 8
+#          parallel clients, check each body byte for byte against the local
+#          copy and report throughput and scaling against a single client
+#   ttlb   time-to-last-byte of each UI file, plain and gzip, median and
+#          p90 over --repeat requests on a keep-alive connection
+#   segments PATH
+#          download PATH in --parts parallel Range requests, reassemble it and
+#          compare against a plain GET; also checks resume (bytes=N-) and an
+#          unsatisfiable range (416)
+#   rps    request the UI assets back to back over one keep-alive connection
+#          for --duration seconds and report requests/sec and per-request
+#          latency. Run once against a build with WEBUI_BUNDLE_ENABLE 1 and
+#          once with 0 to compare the mapped bundle against SPIFFS
+#   upload PATH
+#          POST --size bytes of random data to /upload/PATH --repeat times,
+#          read the file back, delete it and report sustained upload
+#          throughput as measured by the client and by the device
+#   scanimpact
+#          from a soft AP client, download --target back to back while
+#          timing small API requests, first for --duration seconds idle and
+#          then while the device runs a full WiFi scan, and report the
+#          throughput and latency of both phases with the device's account
+#          of the scan. Run once against a build with SCAN_SLICED_ENABLE 1
+#          and once with 0 to compare time-sliced against unsliced scans
+#   roam   over the device's STA address, probe it every --interval seconds
+#          for --duration seconds while it is moved (or its AP attenuated)
+#          between the APs of a multi-AP network, and report each roam the
+#          device made with its own timing and the probes lost around it
+#   connect
+#          over the soft AP, wait for --repeat device resets (power cycle or
+#          reset button) and report, for each boot, how long the STA took
+#          from boot and from association to its IP, and whether it went
+#          straight to the cached access point and reused its DHCP lease.
+#          Run once against a build with STA_LINK_CACHE_ENABLE 1 and once
+#          with 0 to compare, and with STA_STATIC_IP_ENABLE 1 for the
+#          static address. Boots that picked one of several saved networks
+#          also report how long the selection took to join it
+
+import argparse
+import gzip
+import http.client
+import json
+import os
+import sys
+import threading
+import time
+
+UI_ASSETS = ["/index.html", "/style.css", "/script.js"]
+UI_INLINE = ["/"]
+WEBUI_DIR = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "WEBUI")
+
+
+def fetch(host, port, path, headers=None, conn=None):
+    """GET path and return (status, response headers, body bytes, seconds)."""
+    own_conn = conn is None
+    if own_conn:
+        conn = http.client.HTTPConnection(host, port, timeout=30)
+    start = time.perf_counter()
+    conn.request("GET", path, headers=headers or {})
+    resp = conn.getresponse()
+    body = resp.read()
+    elapsed = time.perf_counter() - start
+    if own_conn:
+        conn.close()
+    return resp.status, dict((k.lower(), v) for k, v in resp.getheaders()), body, elapsed
+
+
+def cmd_load(args):
+    for layout, assets in (("files", UI_ASSETS), ("inline", UI_INLINE)):
+        for label, headers in (("identity", {"Accept-Encoding": "identity"}),
+                               ("gzip", {"Accept-Encoding": "gzip, deflate"})):
+            total_bytes = 0
+            samples = []
+            for _ in range(args.repeat):
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=30)
+                start = time.perf_counter()
+                run_bytes = 0
+                for path in assets:
+                    status, hdrs, body, _ = fetch(args.host, args.port, path, headers, conn)
+                    if status != 200:
+                        print("%s: HTTP %d" % (path, status), file=sys.stderr)
+                        return 1
+                    run_bytes += len(body)
+                samples.append(time.perf_counter() - start)
+                conn.close()
+                total_bytes = run_bytes
+            samples.sort()
+            print("%-6s %-9s requests=%d  bytes=%6d  load median=%7.1f ms  min=%7.1f ms" %
+                  (layout, label, len(assets), total_bytes, samples[len(samples) // 2] * 1000, samples[0] * 1000))
+    return 0
+
+
+def cmd_reload(args):
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=30)
+    etags = {}
+    for path in UI_ASSETS:
+        status, hdrs, body, _ = fetch(args.host, args.port, path, {"Accept-Encoding": "gzip"}, conn)
+        etags[path] = hdrs.get("etag")
+        print("first   %-12s %d  bytes=%6d  etag=%s  cache-control=%s" %
+              (path, status, len(body), etags[path], hdrs.get("cache-control")))
+
+    start = time.perf_counter()
+    for path in UI_ASSETS:
+        headers = {"Accept-Encoding": "gzip"}
+        if etags[path]:
+            headers["If-None-Match"] = etags[path]
+        status, _, body, elapsed = fetch(args.host, args.port, path, headers, conn)
+        print("reload  %-12s %d  bytes=%6d  %.1f ms" % (path, status, len(body), elapsed * 1000))
+    print("reload total %.1f ms" % ((time.perf_counter() - start) * 1000))
+    conn.close()
+    return 0
+
+
+def load_webui_files():
+    files = {}
+    for root, _, names in os.walk(WEBUI_DIR):
+        for name in names:
+            path = os.path.join(root, name)
+            with open(path, "rb") as f:
+                files["/" + os.path.relpath(path, WEBUI_DIR).replace(os.sep, "/")] = f.read()
+    return files
+
+
+def download_worker(args, files, errors, counters):
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=30)
+    for _ in range(args.rounds):
+        for path, expected in files.items():
+            for encoding in ("identity", "gzip"):
+                try:
+                    status, hdrs, body, _ = fetch(args.host, args.port, path, {"Accept-Encoding": encoding}, conn)
+                except (OSError, http.client.HTTPException) as e:
+                    errors.append("%s (%s): %s" % (path, encoding, e))
+                    conn.close()
+                    conn = http.client.HTTPConnection(args.host, args.port, timeout=30)
+                    continue
+                counters["bytes"] += len(body)
+                counters["requests"] += 1
+                if status != 200:
+                    errors.append("%s (%s): HTTP %d" % (path, encoding, status))
+                    continue
+                if hdrs.get("content-encoding") == "gzip":
+                    body = gzip.decompress(body)
+                if body != expected:
+                    errors.append("%s (%s): body differs from %s" % (path, encoding, WEBUI_DIR))
+    conn.close()
+
+
+def cmd_concurrent(args):
+    files = load_webui_files()
+    baseline = None
+    failed = False
+    for clients in args.clients:
+        errors = []
+        counters = [{"bytes": 0, "requests": 0} for _ in range(clients)]
+        threads = [threading.Thread(target=download_worker, args=(args, files, errors, counters[i]))
+                   for i in range(clients)]
+        start = time.perf_counter()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        wall = time.perf_counter() - start
+
+        total = sum(c["bytes"] for c in counters)
+        requests = sum(c["requests"] for c in counters)
+        throughput = total / wall
+        baseline = baseline or throughput
+        print("clients=%d  requests=%d  %.1f KB/s  %.1f req/s  scaling=%.2fx  errors=%d" %
+              (clients, requests, throughput / 1024, requests / wall, throughput / baseline, len(errors)))
+        for e in errors[:10]:
+            print("  " + e)
+        failed = failed or bool(errors)
+    return 1 if failed else 0
+
+
+def cmd_segments(args):
+    identity = {"Accept-Encoding": "identity"}
+    status, hdrs, full, _ = fetch(args.host, args.port, args.target, identity)
+    if status != 200 or hdrs.get("accept-ranges") != "bytes":
+        print("%s: HTTP %d, Accept-Ranges=%s" % (args.target, status, hdrs.get("accept-ranges")), file=sys.stderr)
+        return 1
+    size = len(full)
+
+    parts = [None] * args.parts
+    errors = []
+
+    def get_part(i):
+        start = size * i // args.parts
+        end = size * (i + 1) // args.parts - 1
+        if end < start:
+            parts[i] = b""
+            return
+        headers = dict(identity, Range="bytes=%d-%d" % (start, end))
+        status, hdrs, body, _ = fetch(args.host, args.port, args.target, headers)
+        if status != 206 or hdrs.get("content-range") != "bytes %d-%d/%d" % (start, end, size):
+            errors.append("part %d: HTTP %d, Content-Range=%s" % (i, status, hdrs.get("content-range")))
+        parts[i] = body
+
+    start = time.perf_counter()
+    threads = [threading.Thread(target=get_part, args=(i,)) for i in range(args.parts)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+    if not errors and b"".join(parts) != full:
+        errors.append("reassembled body differs from full download")
+
+    status, hdrs, body, _ = fetch(args.host, args.port, args.target, dict(identity, Range="bytes=%d-" % (size // 2)))
+    if status != 206 or body != full[size // 2:]:
+        errors.append("resume from %d: HTTP %d, %d bytes" % (size // 2, status, len(body)))
+    status, hdrs, _, _ = fetch(args.host, args.port, args.target, dict(identity, Range="bytes=%d-" % size))
+    if status != 416 or hdrs.get("content-range") != "bytes */%d" % size:
+        errors.append("range past end: HTTP %d, Content-Range=%s" % (status, hdrs.get("content-range")))
+
+    print("%s: %d bytes in %d parts, %.1f ms, errors=%d" % (args.target, size, args.parts, elapsed * 1000, len(errors)))
+    for e in errors:
+        print("  " + e)
+    return 1 if errors else 0
+
+
+def percentile(samples, pct):
+    return samples[min(len(samples) - 1, int(len(samples) * pct / 100))]
+
+
+def cmd_ttlb(args):
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=30)
+    for path in UI_ASSETS:
+        for encoding in ("identity", "gzip"):
+            samples = []
+            framing = None
+            for _ in range(args.repeat):
+                status, hdrs, body, elapsed = fetch(args.host, args.port, path, {"Accept-Encoding": encoding}, conn)
+                if status != 200:
+                    print("%s: HTTP %d" % (path, status), file=sys.stderr)
+                    return 1
+                samples.append(elapsed)
+                framing = "chunked" if hdrs.get("transfer-encoding") == "chunked" else "length"
+            samples.sort()
+            print("%-12s %-8s bytes=%6d  %-7s  ttlb p50=%7.2f ms  p90=%7.2f ms" %
+                  (path, encoding, len(body), framing, percentile(samples, 50) * 1000, percentile(samples, 90) * 1000))
+    conn.close()
+    return 0
+
+
+def cmd_rps(args):
+    paths = args.path or UI_ASSETS
+    headers = {"Accept-Encoding": args.encoding}
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=30)
+    latencies = []
+    start = time.perf_counter()
+    while time.perf_counter() - start < args.duration:
+        for path in paths:
+            status, _, _, elapsed = fetch(args.host, args.port, path, headers, conn)
+            if status != 200:
+                print("%s: HTTP %d" % (path, status), file=sys.stderr)
+                return 1
+            latencies.append(elapsed)
+    wall = time.perf_counter() - start
+    conn.close()
+
+    latencies.sort()
+    print("requests=%d  rps=%.1f  latency p50=%.2f ms  p90=%.2f ms  p99=%.2f ms  max=%.2f ms" %
+          (len(latencies), len(latencies) / wall, percentile(latencies, 50) * 1000,
+           percentile(latencies, 90) * 1000, percentile(latencies, 99) * 1000, latencies[-1] * 1000))
+    return 0
+
+
+def cmd_upload(args):
+    data = os.urandom(args.size)
+    client_rates = []
+    device_rates = []
+    for _ in range(args.repeat):
+        conn = http.client.HTTPConnection(args.host, args.port, timeout=60)
+        start = time.perf_counter()
+        conn.request("POST", "/upload/" + args.target.lstrip("/"), body=data,
+                     headers={"Content-Type": "application/octet-stream"})
+        resp = conn.getresponse()
+        body = resp.read()
+        elapsed = time.perf_counter() - start
+        conn.close()
+        if resp.status != 200:
+            print("upload: HTTP %d %s" % (resp.status, body.decode(errors="replace")), file=sys.stderr)
+            return 1
+        client_rates.append(args.size / 1024 / elapsed)
+        device_rates.append(json.loads(body)["kbps"])
+
+    status, _, body, _ = fetch(args.host, args.port, "/" + args.target.lstrip("/"), {"Accept-Encoding": "identity"})
+    if status != 200 or body != data:
+        print("read back: HTTP %d, %d bytes, content %s" %
+              (status, len(body), "matches" if body == data else "differs"), file=sys.stderr)
+        return 1
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=30)
+    conn.request("POST", "/delete/" + args.target.lstrip("/"))
+    conn.getresponse().read()
+    conn.close()
+
+    client_rates.sort()
+    device_rates.sort()
+    print("upload %d bytes x %d: client p50=%.1f KB/s min=%.1f KB/s  device p50=%d KB/s" %
+          (args.size, args.repeat, percentile(client_rates, 50), client_rates[0], percentile(device_rates, 50)))
+    return 0
+
+
+def cmd_scanimpact(args):
+    stop = threading.Event()
+    transfers = []  # (finish time, bytes)
+    latencies = []  # (finish time, seconds)
+    errors = []
+
+    def download():
+        conn = http.client.HTTPConnection(args.host, args.port, timeout=10)
+        while not stop.is_set():
+            try:
+                status, _, body, _ = fetch(args.host, args.port, args.target, {"Accept-Encoding": "identity"}, conn)
+                transfers.append((time.perf_counter(), len(body) if status == 200 else 0))
+            except (OSError, http.client.HTTPException) as e:
+                errors.append("download: %s" % e)
+                conn.close()
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=10)
+
+    def probe():
+        conn = http.client.HTTPConnection(args.host, args.port, timeout=10)
+        while not stop.is_set():
+            try:
+                _, _, _, elapsed = fetch(args.host, args.port, "/api/led/status", conn=conn)
+                latencies.append((time.perf_counter(), elapsed))
+            except (OSError, http.client.HTTPException) as e:
+                errors.append("probe: %s" % e)
+                conn.close()
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=10)
+            time.sleep(0.05)
+
+    def report(name, start, end):
+        kbytes = sum(n for t, n in transfers if start <= t < end) / 1024
+        samples = sorted(s for t, s in latencies if start <= t < end)
+        if not samples:
+            print("%-5s no samples" % name)
+            return
+        print("%-5s %5.1f s  throughput=%7.1f KB/s  latency p50=%7.2f ms  p99=%7.2f ms  max=%7.2f ms" %
+              (name, end - start, kbytes / (end - start), percentile(samples, 50) * 1000,
+               percentile(samples, 99) * 1000, samples[-1] * 1000))
+
+    threads = [threading.Thread(target=download), threading.Thread(target=probe)]
+    for t in threads:
+        t.start()
+    idle_start = time.perf_counter()
+    time.sleep(args.duration)
+    scan_start = time.perf_counter()
+
+    path = "/api/wifi/scan?refresh=1"
+    result = None
+    while time.perf_counter() - scan_start < 120:
+        try:
+            _, _, body, _ = fetch(args.host, args.port, path)
+            result = json.loads(body)
+            if not result["scanning"] and path != "/api/wifi/scan?refresh=1":
+                break
+        except (OSError, http.client.HTTPException, ValueError) as e:
+            errors.append("scan: %s" % e)
+        path = "/api/wifi/scan"
+        time.sleep(0.25)
+    scan_end = time.perf_counter()
+    stop.set()
+    for t in threads:
+        t.join()
+
+    report("idle", idle_start, scan_start)
+    report("scan", scan_start, scan_end)
+    if result:
+        last = result.get("last_scan", {})
+        print("device: %s scan, %d ms, %d slices, %d deferred, %d AP bytes, %d networks" %
+              ("sliced" if last.get("sliced") else "unsliced", last.get("duration_ms", 0), last.get("slices", 0),
+               last.get("deferred", 0), last.get("ap_bytes", 0), len(result["networks"])))
+    print("errors=%d" % len(errors))
+    for e in errors[:10]:
+        print("  " + e)
+    return 0
+
+
+def cmd_roam(args):
+    stop = threading.Event()
+    probes = []  # (send time, ok)
+    roams = []  # (time seen, status after the roam)
+    errors = []
+
+    def probe():
+        conn = http.client.HTTPConnection(args.host, args.port, timeout=args.interval * 4)
+        while not stop.is_set():
+            sent = time.perf_counter()
+            try:
+                status, _, _, _ = fetch(args.host, args.port, "/api/led/status", conn=conn)
+                probes.append((sent, status == 200))
+            except (OSError, http.client.HTTPException):
+                probes.append((sent, False))
+                conn.close()
+                conn = http.client.HTTPConnection(args.host, args.port, timeout=args.interval * 4)
+            time.sleep(max(0, args.interval - (time.perf_counter() - sent)))
+
+    def watch():
+        last = None
+        while not stop.is_set():
+            try:
+                _, _, body, _ = fetch(args.host, args.port, "/api/wifi/status")
+                status = json.loads(body)
+                count = status["roam"]["roams"]
+                if last is not None and count != last:
+                    roams.append((time.perf_counter(), status))
+                    print("roam %d: now %s RSSI %s, device %d ms to associate, %d ms to IP" %
+                          (count, status.get("bssid"), status.get("rssi"), status["roam"]["roam_ms"],
+                           status["roam"]["roam_ip_ms"]))
+                last = count
+            except (OSError, http.client.HTTPException, ValueError, KeyError) as e:
+                errors.append("status: %s" % e)
+            time.sleep(1)
+
+    threads = [threading.Thread(target=probe), threading.Thread(target=watch)]
+    for t in threads:
+        t.start()
+    start = time.perf_counter()
+    time.sleep(args.duration)
+    stop.set()
+    for t in threads:
+        t.join()
+
+    lost = sum(1 for _, ok in probes if not ok)
+    print("%.0f s: %d probes, %d lost (%.2f%%)" % (time.perf_counter() - start, len(probes), lost,
+                                                  100.0 * lost / max(1, len(probes))))
+    for seen, status in roams:
+        # The status poll sees a roam up to a second late, after an outage
+        # that can be as long as the device's roam_ip_ms
+        window_start = seen - 1 - status["roam"]["roam_ip_ms"] / 1000 - args.interval * 4
+        window = [(t, ok) for t, ok in probes if window_start <= t <= seen]
+        gap = 0.0
+        last_ok = window_start
+        for t, ok in window:
+            if ok:
+                gap = max(gap, t - last_ok)
+                last_ok = t
+        print("roam to %s: %d of %d probes lost, longest gap %.0f ms" %
+              (status.get("bssid"), sum(1 for _, ok in window if not ok), len(window), gap * 1000))
+    print("errors=%d" % len(errors))
+    for e in errors[:10]:
+        print("  " + e)
+    return 0
+
+
+def device_boot(args):
+    """/api/boot of the device, None while it cannot be reached."""
+    try:
+        _, _, body, _ = fetch(args.host, args.port, "/api/boot")
+        return json.loads(body)
+    except (OSError, http.client.HTTPException, ValueError):
+        return None
+
+
+def cmd_connect(args):
+    boots = []
+    last_now = None
+    print("reset the device %d times, waiting for it on %s" % (args.repeat, args.host))
+    while len(boots) < args.repeat:
+        boot = device_boot(args)
+        if boot is None:
+            time.sleep(0.2)
+            continue
+        # A clock that went back means the device rebooted since the last poll
+        rebooted = last_now is not None and boot["now_us"] < last_now
+        last_now = boot["now_us"]
+        if not rebooted:
+            time.sleep(0.2)
+            continue
+        # Until the STA has its IP, or --timeout seconds after boot
+        while boot is None or (boot["phases_us"]["sta_got_ip"] < 0 and boot["now_us"] < args.timeout * 1000000):
+            time.sleep(0.2)
+            boot = device_boot(args)
+        last_now = boot["now_us"]
+        _, _, body, _ = fetch(args.host, args.port, "/api/wifi/status")
+        status = json.loads(body)
+        boots.append(status)
+        lease = status.get("lease", {})
+        print("boot %d: boot to IP %5d ms  association to IP %5d ms  %s, %s" %
+              (len(boots), status["boot_to_ip_ms"], status["assoc_to_ip_ms"],
+               "cached access point" if status["cached_link"] else "full scan",
+               "static IP" if lease.get("source") == "static" else
+               "lease reused" if lease.get("reused") else "new lease"))
+        if status.get("select_attempts") and status["select_ms"] >= 0:
+            print("        saved network joined %d ms after the selection scan started, attempt %d" %
+                  (status["select_ms"], status["select_attempts"]))
+
+    for label, cached in (("cached access point", True), ("full scan", False)):
+        samples = sorted(s["boot_to_ip_ms"] for s in boots if s["cached_link"] == cached and s["boot_to_ip_ms"] >= 0)
+        if samples:
+            print("%-20s boots=%d  boot to IP p50=%d ms  min=%d ms  max=%d ms" %
+                  (label, len(samples), percentile(samples, 50), samples[0], samples[-1]))
+    samples = sorted(s["select_ms"] for s in boots if s.get("select_attempts") and s["select_ms"] >= 0)
+    if samples:
+        print("%-20s boots=%d  scan to joined p50=%d ms  min=%d ms  max=%d ms" %
+              ("saved network", len(samples), percentile(samples, 50), samples[0], samples[-1]))
+    for label, reused in (("lease reused", True), ("new lease", False)):
+        samples = sorted(s["assoc_to_ip_ms"] for s in boots
+                         if s.get("lease", {}).get("source") == "dhcp" and s["lease"]["reused"] == reused and
+                         s["assoc_to_ip_ms"] >= 0)
+        if samples:
+            print("%-20s boots=%d  association to IP p50=%d ms  min=%d ms  max=%d ms" %
+                  (label, len(samples), percentile(samples, 50), samples[0], samples[-1]))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Web UI measurements against a running device")
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--repeat", type=int, default=10)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    sub.add_parser("load").set_defaults(func=cmd_load)
+    sub.add_parser("reload").set_defaults(func=cmd_reload)
+    sub.add_parser("ttlb").set_defaults(func=cmd_ttlb)
+    concurrent = sub.add_parser("concurrent")
+    concurrent.add_argument("--rounds", type=int, default=5)
+    concurrent.add_argument("--clients", type=int, nargs="+", default=[1, 2, 4, 8])
+    concurrent.set_defaults(func=cmd_concurrent)
+    segments = sub.add_parser("segments")
+    segments.add_argument("--parts", type=int, default=4)
+    segments.add_argument("target", metavar="PATH")
+    segments.set_defaults(func=cmd_segments)
+    rps = sub.add_parser("rps")
+    rps.add_argument("--duration", type=float, default=10)
+    rps.add_argument("--encoding", default="gzip")
+    rps.add_argument("path", nargs="*")
+    rps.set_defaults(func=cmd_rps)
+    upload = sub.add_parser("upload")
+    upload.add_argument("--size", type=int, default=256 * 1024)
+    upload.add_argument("target", metavar="PATH")
+    upload.set_defaults(func=cmd_upload)
+    scanimpact = sub.add_parser("scanimpact")
+    scanimpact.add_argument("--duration", type=float, default=10)
+    scanimpact.add_argument("--target", default="/script.js")
+    scanimpact.set_defaults(func=cmd_scanimpact)
+    roam = sub.add_parser("roam")
+    roam.add_argument("--duration", type=float, default=120)
+    roam.add_argument("--interval", type=float, default=0.05)
+    roam.set_defaults(func=cmd_roam)
+    connect = sub.add_parser("connect")
+    connect.add_argument("--timeout", type=float, default=60)
+    connect.set_defaults(func=cmd_connect)
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
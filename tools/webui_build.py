@@ -0,0 +1,280 @@
+# Web UI asset pipeline
+#
+# Stages the contents of WEBUI/ into build/<env>/webui and adds precompressed
+# variants next to every file (name.gz, and name.br when the "brotli" Python
+# module is installed). The firmware picks the variant matching the client's
+# Accept-Encoding header, so the staged tree is what ends up in the SPIFFS
+# image.
+#
+# index.html is also staged as ui.html with style.css and script.js
+# minified and inlined, so the firmware can serve the whole UI at "/" in a
+# single request. The separate files stay in the tree for development.
+#
+# The staged tree is also packed into webui.bin, a flat indexed image for
+# the "webui" partition that the firmware memory-maps and serves without
+# touching SPIFFS (see init_webui_bundle() in src/webui_bundle.c).
+#
+# Used two ways:
+#   - as a PlatformIO extra script (see platformio.ini), where it runs before
+#     every build and points PROJECT_DATA_DIR at the staged tree so that
+#     "pio run -t buildfs" / "-t uploadfs" pick it up, with the filesystem
+#     the firmware mounts (CONFIG_STORAGE_FS_* in the env's sdkconfig).
+#     "pio run -t uploadwebui" flashes the bundle image
+#   - standalone: python tools/webui_build.py [SRC_DIR] [OUT_DIR], then
+#     esptool.py write_flash <webui partition offset> OUT_DIR/../webui.bin
+
+import csv
+import gzip
+import os
+import re
+import shutil
+import struct
+import sys
+
+try:
+    import brotli
+except ImportError:
+    brotli = None
+
+# Files smaller than this are not worth the extra SPIFFS object
+MIN_COMPRESS_SIZE = 256
+
+# File types that are already compressed
+SKIP_EXTENSIONS = (".gz", ".br", ".png", ".jpg", ".jpeg", ".gif", ".ico", ".woff", ".woff2")
+
+
+def compress_gzip(data):
+    # mtime=0 keeps the output reproducible between builds
+    return gzip.compress(data, compresslevel=9, mtime=0)
+
+
+def compress_brotli(data):
+    return brotli.compress(data, quality=11)
+
+
+# Single-request UI, must match WEBUI_INLINE_PATH in src/main.c
+INLINE_NAME = "ui.html"
+
+
+def minify_css(css):
+    css = re.sub(r"/\*.*?\*/", "", css, flags=re.S)
+    css = re.sub(r"\s+", " ", css)
+    css = re.sub(r"\s*([{}:;,>])\s*", r"\1", css)
+    return css.replace(";}", "}").strip()
+
+
+def minify_js(js):
+    """Conservative: drops indentation, blank lines and whole-line comments
+    but never touches the inside of a line, so strings and template
+    literals survive"""
+    js = re.sub(r"^\s*/\*.*?\*/\s*$", "", js, flags=re.S | re.M)
+    lines = (line.strip() for line in js.splitlines())
+    return "\n".join(line for line in lines if line and not line.startswith("//"))
+
+
+def minify_html(html):
+    html = re.sub(r"<!--.*?-->", "", html, flags=re.S)
+    return re.sub(r">\s+<", "><", html).strip()
+
+
+def build_inline_index(src_dir):
+    """index.html with its local stylesheet and script minified and inlined"""
+    def read(name):
+        with open(os.path.join(src_dir, name), encoding="utf-8") as f:
+            return f.read()
+
+    def inline_css(match):
+        return "<style>%s</style>" % minify_css(read(match.group(1)))
+
+    def inline_js(match):
+        js = minify_js(read(match.group(1)))
+        if "</script" in js.lower():
+            raise ValueError("webui: %s contains '</script', cannot inline it" % match.group(1))
+        return "<script>%s</script>" % js
+
+    html = minify_html(read("index.html"))
+    html = re.sub(r'<link rel="stylesheet" href="([^":/]+)">', inline_css, html)
+    html = re.sub(r'<script src="([^":/]+)"></script>', inline_js, html)
+    return html.encode("utf-8")
+
+
+def stage_webui(src_dir, out_dir, verbose=True):
+    """Copy src_dir into out_dir, add the inlined ui.html and .gz/.br
+    variants. Returns the list of (relative path, original size, gzip size,
+    brotli size) tuples."""
+    if os.path.isdir(out_dir):
+        shutil.rmtree(out_dir)
+    os.makedirs(out_dir)
+
+    files = []
+    for root, _, names in os.walk(src_dir):
+        for name in sorted(names):
+            src = os.path.join(root, name)
+            with open(src, "rb") as f:
+                files.append((os.path.relpath(src, src_dir), f.read()))
+    if os.path.isfile(os.path.join(src_dir, "index.html")):
+        files.append((INLINE_NAME, build_inline_index(src_dir)))
+
+    report = []
+    for rel, data in files:
+        name = os.path.basename(rel)
+        dst = os.path.join(out_dir, rel)
+        os.makedirs(os.path.dirname(dst), exist_ok=True)
+        with open(dst, "wb") as out:
+            out.write(data)
+
+        gz_size = br_size = None
+        if len(data) >= MIN_COMPRESS_SIZE and not name.lower().endswith(SKIP_EXTENSIONS):
+            gz = compress_gzip(data)
+            if len(gz) < len(data):
+                with open(dst + ".gz", "wb") as gz_out:
+                    gz_out.write(gz)
+                gz_size = len(gz)
+            if brotli is not None:
+                br = compress_brotli(data)
+                if len(br) < len(data):
+                    with open(dst + ".br", "wb") as br_out:
+                        br_out.write(br)
+                    br_size = len(br)
+        report.append((rel.replace(os.sep, "/"), len(data), gz_size, br_size))
+
+    if verbose:
+        print_report(report)
+    return report
+
+
+# Must match struct webui_bundle_header / webui_bundle_entry in src/webui_bundle.c and .h
+BUNDLE_MAGIC = 0x42495557  # "WUIB"
+BUNDLE_VERSION = 2
+BUNDLE_PATH_MAX = 48
+BUNDLE_HEADER = struct.Struct("<IHHII")
+BUNDLE_ENTRY = struct.Struct("<%dsIIQ" % BUNDLE_PATH_MAX)
+BUNDLE_ALIGN = 4
+
+
+def fnv1a64(data):
+    """Content hash used for ETags, same as fnv1a64_update() in src/http_util.c"""
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def pack_bundle(stage_dir, out_file, max_size=None):
+    """Pack every file under stage_dir into the bundle image out_file."""
+    files = []
+    for root, _, names in os.walk(stage_dir):
+        for name in names:
+            path = os.path.join(root, name)
+            rel = "/" + os.path.relpath(path, stage_dir).replace(os.sep, "/")
+            if len(rel.encode()) >= BUNDLE_PATH_MAX:
+                raise ValueError("webui: path too long for bundle: %s" % rel)
+            with open(path, "rb") as f:
+                files.append((rel.encode(), f.read()))
+    # The firmware looks entries up with bsearch()/strcmp()
+    files.sort(key=lambda item: item[0])
+
+    offset = BUNDLE_HEADER.size + BUNDLE_ENTRY.size * len(files)
+    entries = b""
+    blobs = b""
+    for path, data in files:
+        pad = -offset % BUNDLE_ALIGN
+        blobs += b"\0" * pad
+        offset += pad
+        entries += BUNDLE_ENTRY.pack(path, offset, len(data), fnv1a64(data))
+        blobs += data
+        offset += len(data)
+
+    image = BUNDLE_HEADER.pack(BUNDLE_MAGIC, BUNDLE_VERSION, len(files), offset, 0) + entries + blobs
+    if max_size is not None and len(image) > max_size:
+        raise ValueError("webui: bundle is %d bytes, partition holds %d" % (len(image), max_size))
+    with open(out_file, "wb") as f:
+        f.write(image)
+    print("webui: bundle %s: %d files, %d bytes" % (out_file, len(files), len(image)))
+    return out_file
+
+
+def parse_size(value):
+    value = value.strip()
+    for suffix, mult in (("K", 1024), ("M", 1024 * 1024)):
+        if value.upper().endswith(suffix):
+            return int(value[:-1], 0) * mult
+    return int(value, 0)
+
+
+def bundle_partition(partitions_csv, label="webui"):
+    """Return (offset, size) of the bundle partition from partitions.csv."""
+    with open(partitions_csv) as f:
+        rows = [r for r in csv.reader(f) if r and not r[0].lstrip().startswith("#")]
+    for row in rows:
+        row = [c.strip() for c in row]
+        if row[0] == label:
+            if not row[3]:
+                raise ValueError("webui: give the '%s' partition an explicit offset" % label)
+            return parse_size(row[3]), parse_size(row[4])
+    raise ValueError("webui: no '%s' partition in %s" % (label, partitions_csv))
+
+
+def print_report(report):
+    print("webui: %-24s %8s %8s %8s" % ("file", "orig", "gzip", "brotli"))
+    total = [0, 0, 0]
+    for rel, size, gz_size, br_size in report:
+        print("webui: %-24s %8d %8s %8s" % (rel, size, gz_size or "-", br_size or "-"))
+        total[0] += size
+        total[1] += gz_size or size
+        total[2] += br_size or gz_size or size
+    print("webui: %-24s %8d %8d %8d" % ("total", total[0], total[1], total[2]))
+
+
+def storage_filesystem(sdkconfig):
+    # The storage backend chosen in src/Kconfig.projbuild, as a PlatformIO
+    # board_build.filesystem value. Before the first build writes the
+    # sdkconfig, this is the Kconfig default
+    try:
+        with open(sdkconfig) as f:
+            if "CONFIG_STORAGE_FS_LITTLEFS=y\n" in f:
+                return "littlefs"
+    except FileNotFoundError:
+        pass
+    return "spiffs"
+
+
+def main(argv):
+    here = os.path.dirname(os.path.abspath(__file__))
+    project_dir = os.path.dirname(here)
+    src_dir = argv[1] if len(argv) > 1 else os.path.join(project_dir, "WEBUI")
+    out_dir = argv[2] if len(argv) > 2 else os.path.join(project_dir, "build", "webui")
+    stage_webui(src_dir, out_dir)
+    _, size = bundle_partition(os.path.join(project_dir, "partitions.csv"))
+    pack_bundle(out_dir, os.path.join(os.path.dirname(out_dir), "webui.bin"), size)
+    return 0
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO's SCons environment
+except NameError:
+    env = None
+
+if env is not None:
+    src_dir = env.subst("$PROJECT_DATA_DIR")
+    out_dir = os.path.join(env.subst("$BUILD_DIR"), "webui")
+    stage_webui(src_dir, out_dir)
+    env.Replace(PROJECT_DATA_DIR=out_dir)
+
+    sdkconfig = env.BoardConfig().get(
+        "build.esp-idf.sdkconfig_path",
+        os.path.join(env.subst("$PROJECT_DIR"), "sdkconfig.%s" % env.subst("$PIOENV")),
+    )
+    env.BoardConfig().update("build.filesystem", storage_filesystem(sdkconfig))
+
+    bundle_offset, bundle_size = bundle_partition(os.path.join(env.subst("$PROJECT_DIR"), "partitions.csv"))
+    bundle_file = pack_bundle(out_dir, os.path.join(env.subst("$BUILD_DIR"), "webui.bin"), bundle_size)
+    env.AddCustomTarget(
+        name="uploadwebui",
+        dependencies=None,
+        actions=['"$PYTHONEXE" "$UPLOADER" $UPLOADERFLAGS 0x%x "%s"' % (bundle_offset, bundle_file)],
+        title="Upload web UI bundle",
+        description="Flash the memory-mapped web UI bundle to the 'webui' partition",
+    )
+elif __name__ == "__main__":
+    sys.exit(main(sys.argv))